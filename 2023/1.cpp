@@ -75,177 +75,635 @@
  *
  */
 
+#include <algorithm>
+#include <bit>
 #include <cctype>
 #include <cstddef>
+#include <cstdint>
+#include <cstdio>
 #include <fstream>
-#include <functional>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <span>
+#include <stdexcept>
 #include <string>
 #include <string_view>
-#include <unordered_map>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 using namespace std;
 
-unsigned long part_one(const string &filename) {
+static inline string read_file(const string &filename) {
+    string buffer;
+    ifstream ifs(filename, ios::binary | ios::ate);
+
+    if (!ifs) {
+        return buffer;
+    }
+
+    buffer.resize(ifs.tellg());
+    ifs.seekg(0);
+    ifs.read(buffer.data(), buffer.size());
+    return buffer;
+}
+
+// Sum of the calibration values over a range of lines, along with the first
+// line whose calibration value cannot be recovered, if any.
+struct Calibration {
     unsigned long sum = 0;
-    unsigned long line_value;
-    string line;
-    ifstream ifs(filename);
-
-    while (getline(ifs, line)) {
-        string_view line_view = line;
-
-        // Starting from the beginning to find the first digit
-        auto it = line_view.begin();
-        for (; it != line_view.end(); ++it) {
-            if (isdigit(*it)) {
-                line_value = (*it - '0') * 10;
-                break;
-            }
+    optional<string_view> bad_line;
+};
+
+// Splits the buffer into at most n ranges of whole lines of similar size.
+static inline vector<string_view> split_lines(string_view buffer, size_t n) {
+    vector<string_view> ranges;
+
+    for (; !buffer.empty(); --n) {
+        size_t len = buffer.size();
+        if (n > 1) {
+            size_t eol = buffer.find('\n', len / n);
+            len = eol == string_view::npos ? len : eol + 1;
         }
+        ranges.push_back(buffer.substr(0, len));
+        buffer.remove_prefix(len);
+    }
+
+    return ranges;
+}
+
+// Computes the calibration of each line-aligned range of the buffer on its own
+// thread and reduces the partial sums. With one thread this is the serial
+// path.
+template <class F>
+static unsigned long
+parallel_sum(string_view buffer, unsigned num_threads, F sum_range) {
+    auto ranges = split_lines(buffer, num_threads);
+    vector<Calibration> partials(ranges.size());
+    vector<thread> workers;
+
+    for (size_t i = 1; i < ranges.size(); ++i) {
+        workers.emplace_back(
+            [&, i]() { partials[i] = sum_range(ranges[i]); });
+    }
+    if (!ranges.empty()) {
+        partials[0] = sum_range(ranges[0]);
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
 
-        if (it == line_view.end()) {
-            cerr << "Failed to find the first digit for line: " << line_view
-                 << endl;
+    unsigned long sum = 0;
+    for (const auto &partial : partials) {
+        if (partial.bad_line) {
+            cerr << "Failed to find the first digit for line: "
+                 << *partial.bad_line << endl;
             return -1;
         }
+        sum += partial.sum;
+    }
 
-        // Starting from the end to find the last digit
-        auto rit = line_view.rbegin();
-        for (; rit != line_view.rend(); ++rit) {
-            if (isdigit(*rit)) {
-                line_value += (*rit - '0');
-                break;
+    return sum;
+}
+
+// Feeds the file to `consume` in fixed-size blocks, so that the memory
+// footprint stays constant regardless of the input or line lengths.
+template <class F>
+static inline void read_blocks(FILE *file, F consume) {
+    static constexpr size_t block_size = 1 << 16;
+    auto block = make_unique<char[]>(block_size);
+
+    while (size_t len = fread(block.get(), 1, block_size, file)) {
+        consume(string_view(block.get(), len));
+    }
+}
+
+// Bit i of each mask corresponds to the i-th byte of a 64-byte block.
+struct BlockMasks {
+    uint64_t newlines = 0;
+    uint64_t digits = 0;
+};
+
+// Running state of the first/last digit scan over a calibration document. The
+// document may be fed in arbitrary pieces; lines are delimited by '\n'.
+class DigitScan {
+public:
+    static constexpr size_t npos = string::npos;
+
+    unsigned long sum = 0;
+    size_t offset = 0;        // Number of bytes consumed so far
+    size_t line_begin = 0;    // Offset of the beginning of the current line
+    size_t bad_line = npos;   // Offset of the first line without any digit
+    int first = -1;
+    int last = -1;
+
+    void end_line(size_t line_end) {
+        if (first < 0) {
+            if (bad_line == npos) {
+                bad_line = line_begin;
             }
+        } else {
+            sum += first * 10 + last;
         }
+        first = last = -1;
+        line_begin = line_end + 1;
+    }
 
-        if (rit == line_view.rend()) {
-            cerr << "Failed to find the last digit for line: " << line_view
-                 << endl;
-            return -1;
+    // Handles the last line if the document doesn't end with a newline.
+    void finish() {
+        if (offset > line_begin) {
+            end_line(offset);
         }
+    }
+};
+
+static inline BlockMasks scan_block_scalar(const char *p, size_t len) {
+    BlockMasks masks;
 
-        sum += line_value;
+    for (size_t i = 0; i < len; ++i) {
+        masks.newlines |= static_cast<uint64_t>(p[i] == '\n') << i;
+        masks.digits |= static_cast<uint64_t>(isdigit(p[i]) != 0) << i;
     }
 
-    return sum;
+    return masks;
 }
 
-struct StringHash {
-    using is_transparent = void; // enables heterogenous lookup
-    size_t operator()(string_view sv) const { return hash<string_view>()(sv); }
-};
+#if defined(__SSE2__)
+static inline BlockMasks scan_block_sse2(const char *p) {
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i zero = _mm_set1_epi8('0');
+    const __m128i nine = _mm_set1_epi8(9);
+    BlockMasks masks;
 
-static const unordered_map<string_view, int, StringHash, equal_to<>>
-    letter_digit_map = {
-        {"one",   1},
-        {"two",   2},
-        {"three", 3},
-        {"four",  4},
-        {"five",  5},
-        {"six",   6},
-        {"seven", 7},
-        {"eight", 8},
-        {"nine",  9},
-};
+    for (int i = 0; i < 4; ++i) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p) + i);
+        // A byte is a digit iff (c - '0') as unsigned is no greater than 9.
+        __m128i d = _mm_sub_epi8(v, zero);
+        __m128i is_digit = _mm_cmpeq_epi8(_mm_min_epu8(d, nine), d);
+        __m128i is_newline = _mm_cmpeq_epi8(v, newline);
+        masks.digits |=
+            static_cast<uint64_t>(static_cast<uint16_t>(
+                _mm_movemask_epi8(is_digit)))
+            << (i * 16);
+        masks.newlines |=
+            static_cast<uint64_t>(static_cast<uint16_t>(
+                _mm_movemask_epi8(is_newline)))
+            << (i * 16);
+    }
+
+    return masks;
+}
+
+__attribute__((target("avx2"))) static inline BlockMasks
+scan_block_avx2(const char *p) {
+    const __m256i newline = _mm256_set1_epi8('\n');
+    const __m256i zero = _mm256_set1_epi8('0');
+    const __m256i nine = _mm256_set1_epi8(9);
+    BlockMasks masks;
 
-// Returns the numerical value if it is a digit or a letter digit in the forward
-// direction. Returns -1 otherwise.
-int fwd_digit(const string_view::iterator &it, const string_view &line) {
-    if (isdigit(*it)) {
-        return *it - '0';
+    for (int i = 0; i < 2; ++i) {
+        __m256i v =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p) + i);
+        __m256i d = _mm256_sub_epi8(v, zero);
+        __m256i is_digit = _mm256_cmpeq_epi8(_mm256_min_epu8(d, nine), d);
+        __m256i is_newline = _mm256_cmpeq_epi8(v, newline);
+        masks.digits |= static_cast<uint64_t>(static_cast<uint32_t>(
+                            _mm256_movemask_epi8(is_digit)))
+                        << (i * 32);
+        masks.newlines |= static_cast<uint64_t>(static_cast<uint32_t>(
+                              _mm256_movemask_epi8(is_newline)))
+                          << (i * 32);
     }
 
-    unsigned long pos = it - line.begin();
-    for (unsigned len = 3; len <= 5 && pos + len <= line.size(); ++len) {
-        string_view word = line.substr(pos, len);
-        if (auto map_it = letter_digit_map.find(word);
-            map_it != letter_digit_map.end()) {
-            return map_it->second;
+    return masks;
+}
+#endif
+
+// Extracts the first/last digits of every line segment in the block from the
+// bitmasks, without looking at the non-digit bytes.
+[[gnu::always_inline]] static inline void
+consume_block(DigitScan &scan, const char *p, BlockMasks masks) {
+    uint64_t digits = masks.digits;
+    uint64_t newlines = masks.newlines;
+
+    while (newlines) {
+        uint64_t line_end = newlines & -newlines;
+        if (uint64_t segment = digits & (line_end - 1); segment) {
+            if (scan.first < 0) {
+                scan.first = p[countr_zero(segment)] - '0';
+            }
+            scan.last = p[63 - countl_zero(segment)] - '0';
         }
+        scan.end_line(scan.offset + countr_zero(newlines));
+        digits &= ~(line_end | (line_end - 1));
+        newlines &= newlines - 1;
     }
 
-    return -1;
-};
+    if (digits) {
+        if (scan.first < 0) {
+            scan.first = p[countr_zero(digits)] - '0';
+        }
+        scan.last = p[63 - countl_zero(digits)] - '0';
+    }
+}
 
-// Returns the numerical value if it is a digit or a letter digit in the reverse
-// direction. Returns -1 otherwise.
-int rev_digit(const string_view::reverse_iterator &it,
-              const string_view &line) {
-    if (isdigit(*it)) {
-        return *it - '0';
+template <BlockMasks (*scan_block)(const char *)>
+[[gnu::always_inline]] static inline void
+scan_digits_impl(DigitScan &scan, const char *p, size_t len) {
+    for (; len >= 64; p += 64, len -= 64) {
+        consume_block(scan, p, scan_block(p));
+        scan.offset += 64;
     }
 
-    unsigned long pos = it - line.rbegin();
-    for (unsigned len = 3; len <= 5 && pos + len <= line.size(); ++len) {
-        string_view word = line.substr(line.size() - pos - len, len);
-        if (auto map_it = letter_digit_map.find(word);
-            map_it != letter_digit_map.end()) {
-            return map_it->second;
-        }
+    if (len > 0) {
+        consume_block(scan, p, scan_block_scalar(p, len));
+        scan.offset += len;
+    }
+}
+
+#if defined(__SSE2__)
+static void scan_digits_sse2(DigitScan &scan, const char *p, size_t len) {
+    scan_digits_impl<scan_block_sse2>(scan, p, len);
+}
+
+__attribute__((target("avx2"))) static void
+scan_digits_avx2(DigitScan &scan, const char *p, size_t len) {
+    scan_digits_impl<scan_block_avx2>(scan, p, len);
+}
+#else
+static inline BlockMasks scan_block_generic(const char *p) {
+    return scan_block_scalar(p, 64);
+}
+
+static void scan_digits_generic(DigitScan &scan, const char *p, size_t len) {
+    scan_digits_impl<scan_block_generic>(scan, p, len);
+}
+#endif
+
+// Feeds the bytes to the digit scan with the widest kernel the CPU supports.
+static inline void scan_digits(DigitScan &scan, string_view data) {
+#if defined(__SSE2__)
+    static const auto kernel =
+        __builtin_cpu_supports("avx2") ? scan_digits_avx2 : scan_digits_sse2;
+#else
+    static const auto kernel = scan_digits_generic;
+#endif
+    kernel(scan, data.data(), data.size());
+}
+
+static inline Calibration sum_digits(string_view range) {
+    DigitScan scan;
+    Calibration result;
+
+    scan_digits(scan, range);
+    scan.finish();
+    result.sum = scan.sum;
+
+    if (scan.bad_line != DigitScan::npos) {
+        string_view line = range.substr(scan.bad_line);
+        result.bad_line = line.substr(0, line.find('\n'));
     }
 
-    return -1;
+    return result;
+}
+
+// Reports the result of a scan over a stream, whose lines are gone by now.
+static inline unsigned long stream_result(const DigitScan &scan) {
+    if (scan.bad_line != DigitScan::npos) {
+        cerr << "Failed to find the first digit for line at byte offset: "
+             << scan.bad_line << endl;
+        return -1;
+    }
+
+    return scan.sum;
+}
+
+unsigned long part_one(const string &filename, unsigned num_threads) {
+    if (filename == "-") {
+        DigitScan scan;
+        read_blocks(stdin,
+                    [&](string_view block) { scan_digits(scan, block); });
+        scan.finish();
+        return stream_result(scan);
+    }
+
+    string buffer = read_file(filename);
+    return parallel_sum(buffer, num_threads, sum_digits);
+}
+
+// A word that spells out a digit. Plain digits are words of length one.
+struct DigitWord {
+    string_view word;
+    int value;
 };
 
-unsigned long part_two(const string &filename) {
-    unsigned long sum = 0;
-    unsigned long line_value;
-    string line;
-    ifstream ifs(filename);
-
-    while (getline(ifs, line)) {
-        string_view line_view = line;
-
-        // Starting from the beginning to find the first digit
-        auto it = line_view.begin();
-        for (; it != line_view.end(); ++it) {
-            if (int digit = fwd_digit(it, line_view); digit >= 0) {
-                line_value = digit * 10;
-                break;
+static constexpr DigitWord default_digit_words[] = {
+    {"0",     0},
+    {"1",     1},
+    {"2",     2},
+    {"3",     3},
+    {"4",     4},
+    {"5",     5},
+    {"6",     6},
+    {"7",     7},
+    {"8",     8},
+    {"9",     9},
+    {"one",   1},
+    {"two",   2},
+    {"three", 3},
+    {"four",  4},
+    {"five",  5},
+    {"six",   6},
+    {"seven", 7},
+    {"eight", 8},
+    {"nine",  9},
+};
+
+enum class Direction { forward, reverse };
+
+/**
+ * Aho-Corasick automaton over a set of digit words, compiled into a complete
+ * DFA transition table so that scanning costs one table load per byte. The
+ * reverse automaton is built from the reversed words and is meant to be run
+ * from the end of a line. A scan finds the word that starts first in the scan
+ * direction, and the longest one if several do, so the first digit of a line is
+ * the word starting earliest and the last digit is the word ending latest. When
+ * a word is contained in another, the scan goes on past the first completed
+ * word while the current state could still belong to a word starting earlier.
+ * For example, with the words "abcd" and "bc", "xabcdx" is 55.
+ */
+template <size_t MaxStates>
+class DigitAutomaton {
+    static_assert(MaxStates <= 65536, "states must fit in uint16_t");
+
+public:
+    // Small automata keep one byte per transition.
+    using state_t = conditional_t<MaxStates <= 256, uint8_t, uint16_t>;
+
+    state_t next[MaxStates][256]{};
+    int8_t value[MaxStates]{}; // Digit matched upon entering the state or -1
+    state_t length[MaxStates]{}; // Length of the (longest) word matched
+    state_t depth[MaxStates]{}; // Length of the prefix the state stands for
+    size_t num_states = 1;
+
+    constexpr DigitAutomaton(span<const DigitWord> words, Direction dir) {
+        for (auto &v : value) {
+            v = -1;
+        }
+
+        // Build the trie. A zero transition is a missing edge, since the root
+        // is never a child.
+        for (const auto &[word, digit] : words) {
+            if (word.empty() || digit < 0 || digit > 9) {
+                throw invalid_argument("Invalid digit word: '" +
+                                       string{word} + "'");
+            }
+
+            size_t state = 0;
+            for (size_t i = 0; i < word.size(); ++i) {
+                unsigned char c = dir == Direction::forward
+                                      ? word[i]
+                                      : word[word.size() - 1 - i];
+                if (next[state][c] == 0) {
+                    if (num_states >= MaxStates) {
+                        throw length_error("Too many states for digit words");
+                    }
+                    depth[num_states] = depth[state] + 1;
+                    next[state][c] = num_states++;
+                }
+                state = next[state][c];
             }
+            value[state] = digit;
+            length[state] = word.size();
         }
 
-        if (it == line_view.end()) {
-            cerr << "Failed to find the first digit for line: " << line_view
-                 << endl;
-            return -1;
+        // Compute the failure links breadth-first and fold them into the
+        // transition table.
+        state_t fail[MaxStates]{};
+        state_t queue[MaxStates]{};
+        size_t head = 0, tail = 0;
+
+        for (size_t c = 0; c < 256; ++c) {
+            if (next[0][c] != 0) {
+                queue[tail++] = next[0][c];
+            }
+        }
+
+        while (head < tail) {
+            state_t state = queue[head++];
+            if (value[state] < 0) {
+                value[state] = value[fail[state]];
+                length[state] = length[fail[state]];
+            }
+            for (size_t c = 0; c < 256; ++c) {
+                if (state_t child = next[state][c]; child != 0) {
+                    fail[child] = next[fail[state]][c];
+                    queue[tail++] = child;
+                } else {
+                    next[state][c] = next[fail[state]][c];
+                }
+            }
         }
+    }
+
+    // Returns the digit of the word starting first in [begin, end), or -1.
+    template <class It>
+    constexpr int find(It begin, It end) const {
+        state_t state = 0;
+        int digit = -1;
+        size_t start = numeric_limits<size_t>::max();
 
-        // Starting from the end to find the last digit
-        auto rit = line_view.rbegin();
-        for (; rit != line_view.rend(); ++rit) {
-            if (int digit = rev_digit(rit, line_view); digit >= 0) {
-                line_value += digit;
+        for (size_t i = 1; begin != end; ++begin, ++i) {
+            state = next[state][static_cast<unsigned char>(*begin)];
+            if (value[state] >= 0 && i - length[state] <= start) {
+                digit = value[state];
+                start = i - length[state];
+            }
+            // Words completed later start no earlier than the state's prefix.
+            if (digit >= 0 && i - depth[state] > start) {
                 break;
             }
         }
 
-        if (rit == line_view.rend()) {
-            cerr << "Failed to find the last digit for line: " << line_view
-                 << endl;
-            return -1;
+        return digit;
+    }
+};
+
+static constexpr DigitAutomaton<64> default_fwd_automaton(default_digit_words,
+                                                          Direction::forward);
+static constexpr DigitAutomaton<64> default_rev_automaton(default_digit_words,
+                                                          Direction::reverse);
+
+// Reads extra digit words, one "<word> <digit>" pair per line. The words are
+// views into `storage`, which must outlive them.
+static inline vector<DigitWord> read_vocabulary(const string &filename,
+                                                string &storage) {
+    vector<DigitWord> words(begin(default_digit_words),
+                            end(default_digit_words));
+    storage = read_file(filename);
+    string_view rest = storage;
+
+    while (!rest.empty()) {
+        string_view line = rest.substr(0, rest.find('\n'));
+        rest.remove_prefix(min(line.size() + 1, rest.size()));
+        if (line.ends_with('\r')) {
+            line.remove_suffix(1);
+        }
+
+        auto sep = line.find(' ');
+        if (line.empty()) {
+            continue;
+        } else if (sep == string_view::npos || sep + 2 != line.size() ||
+                   !isdigit(line.back())) {
+            throw invalid_argument("Failed reading the vocabulary at line: '" +
+                                   string{line} + "'");
         }
 
-        sum += line_value;
+        words.push_back({line.substr(0, sep), line.back() - '0'});
     }
 
-    return sum;
+    return words;
+}
+
+template <size_t N>
+static Calibration sum_spelled_digits(string_view range,
+                                      const DigitAutomaton<N> &fwd,
+                                      const DigitAutomaton<N> &rev) {
+    Calibration result;
+
+    while (!range.empty()) {
+        string_view line = range.substr(0, range.find('\n'));
+        range.remove_prefix(min(line.size() + 1, range.size()));
+
+        int first = fwd.find(line.begin(), line.end());
+        if (first < 0) {
+            result.bad_line = line;
+            break;
+        }
+
+        result.sum += first * 10 + rev.find(line.rbegin(), line.rend());
+    }
+
+    return result;
+}
+
+// Forward-only variant of the spelled digit scan for streams, where a line may
+// span several blocks. The automaton state and the start offset of the first
+// digit's word are carried across blocks. The first digit is the word starting
+// earliest, as in DigitAutomaton::find, and the last digit is the (longest)
+// word completed last on the line.
+template <size_t N>
+static inline void
+scan_spelled_digits(DigitScan &scan,
+                    typename DigitAutomaton<N>::state_t &state,
+                    size_t &first_start,
+                    const DigitAutomaton<N> &fwd,
+                    string_view block) {
+    for (size_t i = 0; i < block.size(); ++i) {
+        if (block[i] == '\n') {
+            scan.end_line(scan.offset + i);
+            state = 0;
+            continue;
+        }
+
+        state = fwd.next[state][static_cast<unsigned char>(block[i])];
+        if (int digit = fwd.value[state]; digit >= 0) {
+            size_t start = scan.offset + i + 1 - fwd.length[state];
+            if (scan.first < 0 || start <= first_start) {
+                scan.first = digit;
+                first_start = start;
+            }
+            scan.last = digit;
+        }
+    }
+
+    scan.offset += block.size();
+}
+
+template <size_t N>
+static unsigned long sum_spelled_digits(const string &filename,
+                                        unsigned num_threads,
+                                        const DigitAutomaton<N> &fwd,
+                                        const DigitAutomaton<N> &rev) {
+    if (filename == "-") {
+        DigitScan scan;
+        typename DigitAutomaton<N>::state_t state = 0;
+        size_t first_start = 0;
+        read_blocks(stdin, [&](string_view block) {
+            scan_spelled_digits(scan, state, first_start, fwd, block);
+        });
+        scan.finish();
+        return stream_result(scan);
+    }
+
+    string buffer = read_file(filename);
+    return parallel_sum(buffer, num_threads, [&](string_view range) {
+        return sum_spelled_digits(range, fwd, rev);
+    });
+}
+
+unsigned long part_two(const string &filename,
+                       const string &vocab_filename,
+                       unsigned num_threads) {
+    if (vocab_filename.empty()) {
+        return sum_spelled_digits(filename, num_threads, default_fwd_automaton,
+                                  default_rev_automaton);
+    }
+
+    string storage;
+    auto words = read_vocabulary(vocab_filename, storage);
+    auto fwd = make_unique<DigitAutomaton<4096>>(words, Direction::forward);
+    auto rev = make_unique<DigitAutomaton<4096>>(words, Direction::reverse);
+    return sum_spelled_digits(filename, num_threads, *fwd, *rev);
 }
 
 int main(int argc, char **argv) {
-    if (argc != 3) {
-        cerr << "There must be exactly 3 arguments." << endl;
+    if (argc < 3 || argc % 2 == 0) {
+        cerr << "Usage: " << argv[0]
+             << " <mode> <input|-> [-j <threads>] [-w <vocabulary>]" << endl;
         return -1;
     }
 
     int mode = stoi(argv[1]);
     string filename(argv[2]);
+    string vocab_filename;
+    unsigned num_threads = 1;
+
+    for (int i = 3; i < argc; i += 2) {
+        string_view option(argv[i]);
+        if (option == "-j") {
+            // Zero threads means one per hardware thread.
+            num_threads = stoul(argv[i + 1]);
+            if (num_threads == 0) {
+                num_threads = max(thread::hardware_concurrency(), 1U);
+            }
+        } else if (option == "-w") {
+            vocab_filename = argv[i + 1];
+        } else {
+            cerr << "Unknown option: " << option << endl;
+            return -1;
+        }
+    }
 
     if (mode == 1) {
-        cout << part_one(filename) << endl;
+        cout << part_one(filename, num_threads) << endl;
     } else if (mode == 2) {
-        cout << part_two(filename) << endl;
+        // A malformed or oversized vocabulary is a usage error.
+        try {
+            cout << part_two(filename, vocab_filename, num_threads) << endl;
+        } catch (const invalid_argument &e) {
+            cerr << e.what() << endl;
+            return -1;
+        } catch (const length_error &e) {
+            cerr << e.what() << endl;
+            return -1;
+        }
     } else {
         cerr << "Unknown mode (must be either 1 or 2): " << mode << endl;
         return -1;
@@ -96,146 +96,694 @@
  *
  */
 
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstdint>
 #include <fstream>
 #include <iostream>
 #include <ostream>
-#include <sstream>
+#include <span>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 using namespace std;
 
-class Cubes {
+// Names of the cube colors, in lane order.
+static constexpr string_view cube_colors[] = {"red", "green", "blue"};
+
+/**
+ * Number of cubes of each color in `Colors`. The counts are stored as 32-bit
+ * lanes padded with zeros to whole 128-bit vectors, so that comparing and
+ * merging sets of cubes take one SIMD instruction per four colors and no
+ * per-color branches.
+ */
+template <const auto &Colors>
+class BasicCubes {
+public:
+    static constexpr size_t num_colors = size(Colors);
+    static constexpr size_t num_lanes = (num_colors + 3) / 4 * 4;
+
+private:
+    alignas(16) int32_t counts[num_lanes]{};
+
+    // Lane of the color by the first letter of its name; -1 if no color starts
+    // with the letter and -2 if several do.
+    static constexpr auto lane_by_letter = []() {
+        array<int8_t, 256> lanes{};
+        lanes.fill(-1);
+        for (size_t c = 0; c < num_colors; ++c) {
+            auto &lane = lanes[static_cast<unsigned char>(Colors[c][0])];
+            lane = lane == -1 ? c : -2;
+        }
+        return lanes;
+    }();
+
+    // Returns the lane of the color name at the front of `s`, or -1.
+    static int find_color(string_view s) {
+        int lane = s.empty() ? -1
+                             : lane_by_letter[static_cast<unsigned char>(s[0])];
+        if (lane == -2) {
+            for (size_t c = 0; c < num_colors; ++c) {
+                if (s.starts_with(Colors[c])) {
+                    return c;
+                }
+            }
+            return -1;
+        }
+        return lane >= 0 && s.starts_with(Colors[lane]) ? lane : -1;
+    }
+
 public:
-    int reds = 0;
-    int greens = 0;
-    int blues = 0;
+    BasicCubes() = default;
+
+    template <class... Counts>
+        requires(sizeof...(Counts) == num_colors)
+    BasicCubes(Counts... _counts) : counts{static_cast<int32_t>(_counts)...} {}
 
-    Cubes() = default;
-    Cubes(int _r, int _g, int _b) : reds(_r), greens(_g), blues(_b) {}
+    int32_t operator[](size_t color) const { return counts[color]; }
+    int32_t &operator[](size_t color) { return counts[color]; }
 
-    explicit Cubes(const string &s) {
-        istringstream iss(s);
-        string color_str;
+    /**
+     * Parses a round such as " 3 blue, 4 red" up to the next ';' or the end of
+     * the game, and removes it (including the ';') from `rounds`. Colors are
+     * told apart by their first letter and counts are parsed in place. Spaces
+     * (including a trailing '\r') around the counts and colors are skipped,
+     * and a blank round has no cubes.
+     */
+    static BasicCubes parse_round(string_view &rounds) {
+        BasicCubes cubes;
+        const char *p = rounds.data();
+        size_t len = rounds.size();
+        size_t i = 0;
 
-        while (getline(iss, color_str, ',')) {
-            if (auto pos = color_str.find("red"); pos != string::npos) {
-                reds = stoi(color_str.substr(0, pos));
+        auto skip_spaces = [&]() {
+            while (i < len && isspace(static_cast<unsigned char>(p[i]))) {
+                ++i;
             }
-            if (auto pos = color_str.find("green"); pos != string::npos) {
-                greens = stoi(color_str.substr(0, pos));
+        };
+
+        while (true) {
+            int count = 0;
+            skip_spaces();
+            if (i >= len || p[i] == ';') {
+                break;
+            }
+            while (i < len && isdigit(p[i])) {
+                count = count * 10 + (p[i++] - '0');
             }
-            if (auto pos = color_str.find("blue"); pos != string::npos) {
-                blues = stoi(color_str.substr(0, pos));
+            skip_spaces(); // Between the count and the color
+
+            int lane = find_color(rounds.substr(min(i, len)));
+            if (lane < 0) {
+                throw invalid_argument("Failed parsing the round: '" +
+                                       string{rounds} + "'");
             }
+            cubes.counts[lane] = count;
+            i += Colors[lane].size();
+
+            skip_spaces();
+            if (i >= len || p[i] == ';') {
+                break;
+            }
+            ++i; // The comma between colors
         }
+
+        rounds.remove_prefix(min(i + 1, len));
+        return cubes;
     }
 
-    bool exceeds(const Cubes &other) const {
-        return reds > other.reds || greens > other.greens ||
-               blues > other.blues;
+    bool exceeds(const BasicCubes &other) const {
+#if defined(__SSE2__)
+        __m128i greater = _mm_setzero_si128();
+        for (size_t i = 0; i < num_lanes; i += 4) {
+            greater = _mm_or_si128(
+                greater, _mm_cmpgt_epi32(lanes(i), other.lanes(i)));
+        }
+        return _mm_movemask_epi8(greater) != 0;
+#else
+        bool greater = false;
+        for (size_t i = 0; i < num_lanes; ++i) {
+            greater |= counts[i] > other.counts[i];
+        }
+        return greater;
+#endif
     }
 
-    void expand(const Cubes &other) {
-        if (reds < other.reds) {
-            reds = other.reds;
+    void expand(const BasicCubes &other) {
+#if defined(__SSE4_1__)
+        for (size_t i = 0; i < num_lanes; i += 4) {
+            store(i, _mm_max_epi32(lanes(i), other.lanes(i)));
         }
-        if (greens < other.greens) {
-            greens = other.greens;
+#elif defined(__SSE2__)
+        for (size_t i = 0; i < num_lanes; i += 4) {
+            __m128i a = lanes(i), b = other.lanes(i);
+            __m128i less = _mm_cmplt_epi32(a, b);
+            store(i, _mm_or_si128(_mm_and_si128(less, b),
+                                  _mm_andnot_si128(less, a)));
         }
-        if (blues < other.blues) {
-            blues = other.blues;
+#else
+        for (size_t i = 0; i < num_lanes; ++i) {
+            counts[i] = max(counts[i], other.counts[i]);
         }
+#endif
     }
 
     unsigned long power() const {
-        return static_cast<unsigned long>(reds) *
-               static_cast<unsigned long>(greens) *
-               static_cast<unsigned long>(blues);
+        unsigned long product = 1;
+        for (size_t c = 0; c < num_colors; ++c) {
+            product *= static_cast<unsigned long>(counts[c]);
+        }
+        return product;
+    }
+
+private:
+#if defined(__SSE2__)
+    __m128i lanes(size_t i) const {
+        return _mm_load_si128(reinterpret_cast<const __m128i *>(counts + i));
     }
+
+    void store(size_t i, __m128i v) {
+        _mm_store_si128(reinterpret_cast<__m128i *>(counts + i), v);
+    }
+#endif
 };
 
-ostream &operator<<(ostream &os, const Cubes &cubes) {
-    os << cubes.reds << " red, " << cubes.greens << " green, " << cubes.blues
-       << " blue";
+using Cubes = BasicCubes<cube_colors>;
+
+template <const auto &Colors>
+ostream &operator<<(ostream &os, const BasicCubes<Colors> &cubes) {
+    for (size_t c = 0; c < BasicCubes<Colors>::num_colors; ++c) {
+        os << (c > 0 ? ", " : "") << cubes[c] << " " << Colors[c];
+    }
     return os;
 }
 
+static inline string read_file(const string &filename) {
+    string buffer;
+    ifstream ifs(filename, ios::binary | ios::ate);
+
+    if (!ifs) {
+        return buffer;
+    }
+
+    buffer.resize(ifs.tellg());
+    ifs.seekg(0);
+    ifs.read(buffer.data(), buffer.size());
+    return buffer;
+}
+
+// Removes and returns the next line of the buffer.
+static inline string_view next_line(string_view &buffer) {
+    string_view line = buffer.substr(0, buffer.find('\n'));
+    buffer.remove_prefix(min(line.size() + 1, buffer.size()));
+    return line;
+}
+
 // Returns the game ID and also removes the prefix until the first colon.
-unsigned long get_game_id(string &line) {
-    unsigned long space_pos = line.find(' ');
-    unsigned long colon_pos = line.find(':');
-    unsigned long game_id =
-        stoul(line.substr(space_pos + 1, colon_pos - space_pos - 1));
-    line.erase(0, colon_pos + 1);
+static inline unsigned long get_game_id(string_view &line) {
+    unsigned long game_id = 0;
+    size_t i = 0;
+
+    while (i < line.size() && !isdigit(line[i])) {
+        ++i;
+    }
+    while (i < line.size() && isdigit(line[i])) {
+        game_id = game_id * 10 + (line[i++] - '0');
+    }
+
+    line.remove_prefix(min(i + 1, line.size()));
     return game_id;
 }
 
-unsigned long part_one(const string &filename) {
-    unsigned long sum = 0;
-    string line;
-    ifstream ifs(filename);
+/**
+ * Structure-of-arrays representation of a game log, parsed once. The rounds of
+ * game i are at [round_offsets[i], round_offsets[i + 1]) of the round columns,
+ * and the per-game maxima are the minimum set of cubes of each game.
+ */
+class GameLog {
+public:
+    using Columns = array<vector<int32_t>, Cubes::num_colors>;
 
-    // 12 red cubes, 13 green cubes, and 14 blue cubes
-    static const Cubes max_cubes(12, 13, 14);
+    vector<int32_t> ids;
+    Columns maxima;
+    vector<uint32_t> round_offsets{0};
+    Columns rounds;
 
-    while (getline(ifs, line)) {
-        bool game_is_possible = true;
-        unsigned long game_id = get_game_id(line);
-        string round_str;
-        istringstream iss(line);
+    GameLog() = default;
+
+    explicit GameLog(string_view buffer) {
+        while (!buffer.empty()) {
+            string_view line = next_line(buffer);
+            Cubes min_cubes;
 
-        while (getline(iss, round_str, ';')) {
-            Cubes round_cubes(round_str);
-            if (round_cubes.exceeds(max_cubes)) {
-                game_is_possible = false;
+            ids.push_back(get_game_id(line));
+            while (!line.empty()) {
+                Cubes round_cubes = Cubes::parse_round(line);
+                for (size_t c = 0; c < Cubes::num_colors; ++c) {
+                    rounds[c].push_back(round_cubes[c]);
+                }
+                min_cubes.expand(round_cubes);
+            }
+
+            round_offsets.push_back(rounds[0].size());
+            for (size_t c = 0; c < Cubes::num_colors; ++c) {
+                maxima[c].push_back(min_cubes[c]);
             }
         }
+    }
 
-        if (game_is_possible) {
-            sum += game_id;
+    size_t size() const { return ids.size(); }
+
+    Cubes min_cubes(size_t game) const {
+        Cubes cubes;
+        for (size_t c = 0; c < Cubes::num_colors; ++c) {
+            cubes[c] = maxima[c][game];
         }
+        return cubes;
     }
+};
 
+// Sums the IDs of games in [begin, end) that are possible with the bag.
+static inline unsigned long sum_possible_ids_scalar(const GameLog &log,
+                                                    const Cubes &bag,
+                                                    size_t begin,
+                                                    size_t end) {
+    unsigned long sum = 0;
+    for (size_t i = begin; i < end; ++i) {
+        if (!log.min_cubes(i).exceeds(bag)) {
+            sum += log.ids[i];
+        }
+    }
     return sum;
 }
 
-unsigned long part_two(const string &filename) {
+// Sums the powers of the minimum sets of games in [begin, end).
+static inline unsigned long
+sum_powers_scalar(const GameLog &log, size_t begin, size_t end) {
     unsigned long sum = 0;
-    string line;
-    ifstream ifs(filename);
+    for (size_t i = begin; i < end; ++i) {
+        sum += log.min_cubes(i).power();
+    }
+    return sum;
+}
+
+#if defined(__SSE2__)
+__attribute__((target("avx2"))) static inline unsigned long
+hsum_epi64(__m256i v) {
+    alignas(32) unsigned long lanes[4];
+    _mm256_store_si256(reinterpret_cast<__m256i *>(lanes), v);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+__attribute__((target("avx2"))) static inline __m256i
+load(const vector<int32_t> &column, size_t i) {
+    return _mm256_loadu_si256(
+        reinterpret_cast<const __m256i *>(column.data() + i));
+}
+
+// Eight games at a time: a game is possible iff no color exceeds the bag.
+__attribute__((target("avx2"))) static unsigned long
+sum_possible_ids_avx2(const GameLog &log, const Cubes &bag) {
+    __m256i acc = _mm256_setzero_si256();
+    size_t i = 0;
+
+    for (; i + 8 <= log.size(); i += 8) {
+        __m256i exceeds = _mm256_setzero_si256();
+        for (size_t c = 0; c < Cubes::num_colors; ++c) {
+            exceeds = _mm256_or_si256(
+                exceeds, _mm256_cmpgt_epi32(load(log.maxima[c], i),
+                                            _mm256_set1_epi32(bag[c])));
+        }
+        __m256i ids = _mm256_andnot_si256(exceeds, load(log.ids, i));
+        acc = _mm256_add_epi64(
+            acc, _mm256_cvtepu32_epi64(_mm256_castsi256_si128(ids)));
+        acc = _mm256_add_epi64(
+            acc, _mm256_cvtepu32_epi64(_mm256_extracti128_si256(ids, 1)));
+    }
+
+    return hsum_epi64(acc) +
+           sum_possible_ids_scalar(log, bag, i, log.size());
+}
+
+// Multiplies the 64-bit lanes of a by the 32-bit values in the low halves of
+// the 64-bit lanes of b, wrapping around like the scalar unsigned long product.
+__attribute__((target("avx2"))) static inline __m256i
+mul_epu64_epu32(__m256i a, __m256i b) {
+    __m256i lo = _mm256_mul_epu32(a, b);
+    __m256i hi = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), b);
+    return _mm256_add_epi64(lo, _mm256_slli_epi64(hi, 32));
+}
+
+// Eight games at a time, with the even and odd lanes multiplied separately.
+__attribute__((target("avx2"))) static unsigned long
+sum_powers_avx2(const GameLog &log) {
+    __m256i acc = _mm256_setzero_si256();
+    size_t i = 0;
+
+    for (; i + 8 <= log.size(); i += 8) {
+        __m256i even = _mm256_set1_epi64x(1);
+        __m256i odd = _mm256_set1_epi64x(1);
+        for (size_t c = 0; c < Cubes::num_colors; ++c) {
+            __m256i counts = load(log.maxima[c], i);
+            even = mul_epu64_epu32(even, counts);
+            odd = mul_epu64_epu32(odd, _mm256_srli_epi64(counts, 32));
+        }
+        acc = _mm256_add_epi64(acc, _mm256_add_epi64(even, odd));
+    }
+
+    return hsum_epi64(acc) + sum_powers_scalar(log, i, log.size());
+}
+#endif
+
+// 12 red cubes, 13 green cubes, and 14 blue cubes
+static const Cubes max_cubes(12, 13, 14);
+
+// Sums the IDs of the games that are possible with the bag by scanning the
+// columns of the log.
+static unsigned long sum_possible_ids(const GameLog &log, const Cubes &bag) {
+#if defined(__SSE2__)
+    if (__builtin_cpu_supports("avx2")) {
+        return sum_possible_ids_avx2(log, bag);
+    }
+#endif
+    return sum_possible_ids_scalar(log, bag, 0, log.size());
+}
+
+unsigned long part_one(const GameLog &log) {
+    return sum_possible_ids(log, max_cubes);
+}
+
+unsigned long part_two(const GameLog &log) {
+#if defined(__SSE2__)
+    if (__builtin_cpu_supports("avx2")) {
+        return sum_powers_avx2(log);
+    }
+#endif
+    return sum_powers_scalar(log, 0, log.size());
+}
+
+// Answers of both parts over a range of games. Aligned to a cache line so that
+// per-thread accumulators do not share one.
+struct alignas(64) GameSums {
+    unsigned long possible_ids = 0;
+    unsigned long powers = 0;
+};
+
+// Splits the buffer into at most n ranges of whole lines of similar size.
+static inline vector<string_view> split_lines(string_view buffer, size_t n) {
+    vector<string_view> ranges;
+
+    for (; !buffer.empty(); --n) {
+        size_t len = buffer.size();
+        if (n > 1) {
+            size_t eol = buffer.find('\n', len / n);
+            len = eol == string_view::npos ? len : eol + 1;
+        }
+        ranges.push_back(buffer.substr(0, len));
+        buffer.remove_prefix(len);
+    }
 
-    while (getline(ifs, line)) {
-        unsigned long game_id [[maybe_unused]] = get_game_id(line);
-        string round_str;
-        istringstream iss(line);
+    return ranges;
+}
+
+// Parses and evaluates the games of the range without storing them.
+static inline void evaluate_games(string_view range, GameSums &sums) {
+    while (!range.empty()) {
+        string_view line = next_line(range);
+        unsigned long game_id = get_game_id(line);
         Cubes min_cubes;
 
-        while (getline(iss, round_str, ';')) {
-            Cubes round_cubes(round_str);
-            min_cubes.expand(round_cubes);
+        while (!line.empty()) {
+            min_cubes.expand(Cubes::parse_round(line));
         }
 
-        sum += min_cubes.power();
+        if (!min_cubes.exceeds(max_cubes)) {
+            sums.possible_ids += game_id;
+        }
+        sums.powers += min_cubes.power();
     }
+}
 
-    return sum;
+// Evaluates line-aligned ranges of the log on separate threads and reduces the
+// answers of both parts.
+static GameSums parallel_evaluate(string_view buffer, unsigned num_threads) {
+    auto ranges = split_lines(buffer, num_threads);
+    vector<GameSums> partials(ranges.size());
+    vector<thread> workers;
+    GameSums sums;
+
+    for (size_t i = 1; i < ranges.size(); ++i) {
+        workers.emplace_back(
+            [&, i]() { evaluate_games(ranges[i], partials[i]); });
+    }
+    if (!ranges.empty()) {
+        evaluate_games(ranges[0], partials[0]);
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+
+    for (const auto &partial : partials) {
+        sums.possible_ids += partial.possible_ids;
+        sums.powers += partial.powers;
+    }
+
+    return sums;
+}
+
+/**
+ * Index over the per-game maxima for answering many bag budget queries against
+ * the same log, offline. A game is possible with a bag iff the bag dominates
+ * its maxima, so the games and the bags are swept in order of the first color,
+ * and the IDs of the games swept so far are kept in a static 2D Fenwick tree
+ * over the ranks of the other two colors. Each node of the outer tree keeps the
+ * sorted ranks of its games, so the index takes O(n log n) space and a batch of
+ * q bags takes O((n + q) log^2 n) time. Logs with more than three colors are
+ * answered by scanning the columns once per bag.
+ */
+class BudgetIndex {
+private:
+    static constexpr bool dominance = Cubes::num_colors <= 3;
+
+    const GameLog &log;
+    vector<uint32_t> order; // Games sorted by the first color
+    vector<int32_t> values[2]; // Sorted distinct maxima of the other colors
+    vector<uint32_t> ranks[2]; // 1-based ranks of each game in values
+    vector<uint32_t> node_offsets; // Keys of node k: [offsets[k], offsets[k+1])
+    vector<uint32_t> node_keys; // Sorted ranks of the other color
+
+    // Missing colors count as zero cubes.
+    static int32_t count(const Cubes &cubes, size_t color) {
+        return color < Cubes::num_colors ? cubes[color] : 0;
+    }
+
+    int32_t maximum(size_t game, size_t color) const {
+        return color < Cubes::num_colors ? log.maxima[color][game] : 0;
+    }
+
+    // Number of distinct maxima of the other color no greater than the count.
+    uint32_t rank(size_t other, int32_t count) const {
+        return upper_bound(values[other].begin(), values[other].end(), count) -
+               values[other].begin();
+    }
+
+    span<const uint32_t> keys(size_t node) const {
+        return span(node_keys).subspan(
+            node_offsets[node], node_offsets[node + 1] - node_offsets[node]);
+    }
+
+    void insert(vector<unsigned long> &sums, size_t game) const {
+        for (size_t k = ranks[0][game]; k <= values[0].size(); k += k & -k) {
+            auto node = keys(k);
+            size_t j = lower_bound(node.begin(), node.end(), ranks[1][game]) -
+                       node.begin() + 1;
+            for (; j <= node.size(); j += j & -j) {
+                sums[node_offsets[k] + j - 1] += log.ids[game];
+            }
+        }
+    }
+
+    unsigned long
+    query(const vector<unsigned long> &sums, size_t q0, uint32_t q1) const {
+        unsigned long sum = 0;
+        for (size_t k = q0; k > 0; k -= k & -k) {
+            auto node = keys(k);
+            size_t j = upper_bound(node.begin(), node.end(), q1) - node.begin();
+            for (; j > 0; j -= j & -j) {
+                sum += sums[node_offsets[k] + j - 1];
+            }
+        }
+        return sum;
+    }
+
+public:
+    explicit BudgetIndex(const GameLog &_log) : log(_log) {
+        if constexpr (!dominance) {
+            return;
+        }
+
+        order.resize(log.size());
+        for (size_t i = 0; i < log.size(); ++i) {
+            order[i] = i;
+        }
+        sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+            return maximum(a, 0) < maximum(b, 0);
+        });
+
+        for (size_t d = 0; d < 2; ++d) {
+            for (size_t i = 0; i < log.size(); ++i) {
+                values[d].push_back(maximum(i, d + 1));
+            }
+            sort(values[d].begin(), values[d].end());
+            values[d].erase(unique(values[d].begin(), values[d].end()),
+                            values[d].end());
+            for (size_t i = 0; i < log.size(); ++i) {
+                ranks[d].push_back(rank(d, maximum(i, d + 1)));
+            }
+        }
+
+        // Each game is a key of the O(log n) nodes covering its rank.
+        size_t num_nodes = values[0].size();
+        node_offsets.assign(num_nodes + 2, 0);
+        for (size_t i = 0; i < log.size(); ++i) {
+            for (size_t k = ranks[0][i]; k <= num_nodes; k += k & -k) {
+                ++node_offsets[k + 1];
+            }
+        }
+        for (size_t k = 1; k < node_offsets.size(); ++k) {
+            node_offsets[k] += node_offsets[k - 1];
+        }
+        node_keys.resize(node_offsets.back());
+        vector<uint32_t> cursors(node_offsets.begin(), node_offsets.end() - 1);
+        for (size_t i = 0; i < log.size(); ++i) {
+            for (size_t k = ranks[0][i]; k <= num_nodes; k += k & -k) {
+                node_keys[cursors[k]++] = ranks[1][i];
+            }
+        }
+        for (size_t k = 1; k <= num_nodes; ++k) {
+            sort(node_keys.begin() + node_offsets[k],
+                 node_keys.begin() + node_offsets[k + 1]);
+        }
+    }
+
+    // Sums the IDs of the games that are possible with each bag.
+    vector<unsigned long> sum_possible_ids(span<const Cubes> bags) const {
+        vector<unsigned long> sums(bags.size());
+
+        if constexpr (!dominance) {
+            for (size_t b = 0; b < bags.size(); ++b) {
+                sums[b] = ::sum_possible_ids(log, bags[b]);
+            }
+            return sums;
+        }
+
+        vector<uint32_t> bag_order(bags.size());
+        for (size_t b = 0; b < bags.size(); ++b) {
+            bag_order[b] = b;
+        }
+        sort(bag_order.begin(), bag_order.end(), [&](uint32_t a, uint32_t b) {
+            return count(bags[a], 0) < count(bags[b], 0);
+        });
+
+        vector<unsigned long> tree(node_keys.size());
+        size_t swept = 0;
+        for (auto b : bag_order) {
+            const Cubes &bag = bags[b];
+            for (; swept < order.size() &&
+                   maximum(order[swept], 0) <= count(bag, 0);
+                 ++swept) {
+                insert(tree, order[swept]);
+            }
+            sums[b] = query(tree, rank(0, count(bag, 1)),
+                            rank(1, count(bag, 2)));
+        }
+
+        return sums;
+    }
+};
+
+// Reads bag budgets, one per line in the same format as a round, e.g.,
+// "12 red, 13 green, 14 blue".
+static inline vector<Cubes> read_budgets(const string &filename) {
+    vector<Cubes> budgets;
+    string buffer = read_file(filename);
+    string_view rest = buffer;
+
+    while (!rest.empty()) {
+        string_view line = next_line(rest);
+        if (!line.empty()) {
+            budgets.push_back(Cubes::parse_round(line));
+        }
+    }
+
+    return budgets;
+}
+
+// Prints the sum of the IDs of the possible games for each budget.
+void query_budgets(const GameLog &log, const string &budgets_filename) {
+    BudgetIndex index(log);
+    vector<Cubes> budgets = read_budgets(budgets_filename);
+
+    for (auto sum : index.sum_possible_ids(budgets)) {
+        cout << sum << endl;
+    }
 }
 
 int main(int argc, char **argv) {
-    if (argc != 3) {
-        cerr << "There must be exactly 3 arguments." << endl;
+    if (argc < 3 || argc % 2 == 0) {
+        cerr << "Usage: " << argv[0]
+             << " <mode> <input> [-j <threads>] [-b <budgets>]" << endl;
         return -1;
     }
 
     int mode = stoi(argv[1]);
     string filename(argv[2]);
+    string budgets_filename;
+    unsigned num_threads = 1;
+
+    for (int i = 3; i < argc; i += 2) {
+        string_view option(argv[i]);
+        if (option == "-j") {
+            // Zero threads means one per hardware thread.
+            num_threads = stoul(argv[i + 1]);
+            if (num_threads == 0) {
+                num_threads = max(thread::hardware_concurrency(), 1U);
+            }
+        } else if (option == "-b") {
+            budgets_filename = argv[i + 1];
+        } else {
+            cerr << "Unknown option: " << option << endl;
+            return -1;
+        }
+    }
+
+    string buffer = read_file(filename);
+
+    if (num_threads > 1 && (mode == 1 || mode == 2)) {
+        GameSums sums = parallel_evaluate(buffer, num_threads);
+        cout << (mode == 1 ? sums.possible_ids : sums.powers) << endl;
+        return 0;
+    }
+
+    GameLog log(buffer);
 
     if (mode == 1) {
-        cout << part_one(filename) << endl;
+        cout << part_one(log) << endl;
     } else if (mode == 2) {
-        cout << part_two(filename) << endl;
+        cout << part_two(log) << endl;
+    } else if (mode == 3 && !budgets_filename.empty()) {
+        query_budgets(log, budgets_filename);
     } else {
-        cerr << "Unknown mode (must be either 1 or 2): " << mode << endl;
+        cerr << "Unknown mode (must be 1, 2, or 3 with -b <budgets>): "
+             << mode << endl;
         return -1;
     }
 
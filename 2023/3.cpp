@@ -98,23 +98,65 @@
  *
  */
 
+#include <algorithm>
+#include <bit>
 #include <cctype>
+#include <cstdint>
 #include <fstream>
 #include <iostream>
-#include <set>
+#include <span>
+#include <stdexcept>
 #include <string>
-#include <tuple>
+#include <string_view>
+#include <thread>
+#include <utility>
 #include <vector>
 
 using namespace std;
 
-static inline vector<string> read_schema(const string &filename) {
-    vector<string> schema;
+/**
+ * Engine schematic stored row-major in one contiguous buffer and surrounded by
+ * a one-cell border of '.', so that every cell of the schematic has all eight
+ * neighbors and no neighborhood access needs a bounds check. Cells are
+ * addressed by their offset into the buffer.
+ */
+class Schema {
+public:
+    size_t rows = 0;   // Number of rows, excluding the border
+    size_t cols = 0;   // Number of columns, excluding the border
+    size_t stride = 2; // Distance between vertically adjacent cells
+    string cells;
+
+    // Offset of the cell at (row, col). Either can be -1 or rows/cols to
+    // address the border.
+    size_t offset(long row, long col) const {
+        return (row + 1) * stride + (col + 1);
+    }
+
+    char operator[](size_t off) const { return cells[off]; }
+};
+
+static inline Schema read_schema(const string &filename) {
+    Schema schema;
     string line;
+    string body;
     ifstream ifs(filename);
 
     while (getline(ifs, line)) {
-        schema.push_back(line);
+        schema.cols = max(schema.cols, line.size());
+        body += line;
+        body += '\n';
+        ++schema.rows;
+    }
+
+    schema.stride = schema.cols + 2;
+    schema.cells.assign((schema.rows + 2) * schema.stride, '.');
+
+    size_t row = 0;
+    for (size_t b = 0; b < body.size(); ++row) {
+        size_t e = body.find('\n', b);
+        body.copy(schema.cells.data() + schema.offset(row, 0), e - b, b);
+        b = e + 1;
     }
 
     return schema;
@@ -125,19 +167,12 @@ static inline bool is_symbol(char c) {
 }
 
 /**
- * @return true if any character in the specified range is a symbol.
+ * @return true if any cell in [b, e) is a symbol.
  * @return false otherwise.
  */
-static inline bool is_symbol(const vector<string> &schema,
-                             vector<string>::size_type row,
-                             string::size_type b,
-                             string::size_type e) {
-    if (row >= schema.size()) {
-        return false;
-    }
-
-    for (auto i = b; i < e && i < schema[row].size(); ++i) {
-        if (is_symbol(schema[row][i])) {
+static inline bool is_symbol(const Schema &schema, size_t b, size_t e) {
+    for (auto i = b; i < e; ++i) {
+        if (is_symbol(schema[i])) {
             return true;
         }
     }
@@ -145,59 +180,163 @@ static inline bool is_symbol(const vector<string> &schema,
     return false;
 }
 
-static inline bool is_part_number(const vector<string> &schema,
-                                  vector<string>::size_type row,
-                                  string::size_type b,
-                                  string::size_type e) {
-    // Check the previous row.
-    if (row > 0) {
-        auto check_b = b > 0 ? b - 1 : b;
-        auto check_e = e < schema[row - 1].size() ? e + 1 : e;
-        if (is_symbol(schema, row - 1, check_b, check_e)) {
-            return true;
+// Parses the number in the cells [b, e).
+static inline unsigned long
+parse_number(const Schema &schema, size_t b, size_t e) {
+    unsigned long num = 0;
+    for (auto i = b; i < e; ++i) {
+        num = num * 10 + (schema[i] - '0');
+    }
+    return num;
+}
+
+// Whether the number in the cells [b, e) of a row is a part number.
+static inline bool is_part_number(const Schema &schema, size_t b, size_t e) {
+    return is_symbol(schema, b - schema.stride - 1, e - schema.stride + 1) ||
+           is_symbol(schema[b - 1]) || is_symbol(schema[e]) ||
+           is_symbol(schema, b + schema.stride - 1, e + schema.stride + 1);
+}
+
+// Sums the part numbers on the rows [first_row, last_row).
+static unsigned long
+sum_part_numbers(const Schema &schema, size_t first_row, size_t last_row) {
+    unsigned long sum = 0;
+
+    for (size_t row = first_row; row < last_row; ++row) {
+        size_t row_end = schema.offset(row, schema.cols);
+        for (size_t b = schema.offset(row, 0); b < row_end; ++b) {
+            if (!isdigit(schema[b]) || isdigit(schema[b - 1])) {
+                continue;
+            }
+
+            // schema[b] is a digit. Find the entire number.
+            size_t e = b + 1;
+            while (isdigit(schema[e])) {
+                ++e;
+            }
+
+            // Add to the sum if [b, e) is a part number.
+            if (is_part_number(schema, b, e)) {
+                sum += parse_number(schema, b, e);
+            }
+            b = e;
         }
     }
 
-    // Check the current row (left and right).
-    if (b > 0 && is_symbol(schema[row][b - 1])) {
-        return true;
+    return sum;
+}
+
+/**
+ * Bit-parallel view of the schematic with one bit per cell (bit i of word w is
+ * column 64 * w + i) and one row of words per schematic row, plus an empty row
+ * above and below.
+ */
+class RowMasks {
+public:
+    size_t words = 0; // Words per row
+    vector<uint64_t> digits;
+    vector<uint64_t> symbols;
+
+    explicit RowMasks(const Schema &schema)
+        : words((schema.cols + 63) / 64),
+          digits((schema.rows + 2) * words),
+          symbols((schema.rows + 2) * words) {
+        for (size_t row = 0; row < schema.rows; ++row) {
+            size_t off = schema.offset(row, 0);
+            for (size_t col = 0; col < schema.cols; ++col) {
+                uint64_t bit = 1UL << (col % 64);
+                size_t w = (row + 1) * words + col / 64;
+                if (isdigit(schema[off + col])) {
+                    digits[w] |= bit;
+                } else if (schema[off + col] != '.') {
+                    symbols[w] |= bit;
+                }
+            }
+        }
+    }
+
+    // Words of the row, where row -1 and row `rows` are empty.
+    const uint64_t *row(const vector<uint64_t> &masks, long r) const {
+        return masks.data() + (r + 1) * words;
     }
-    if (e < schema[row].size() && is_symbol(schema[row][e])) {
-        return true;
+};
+
+// Index of the first clear bit at or after `bit` in the row.
+static inline size_t
+first_clear(const uint64_t *row, size_t words, size_t bit) {
+    size_t w = bit / 64;
+    uint64_t clear = ~row[w] & (~0UL << (bit % 64));
+
+    while (clear == 0 && ++w < words) {
+        clear = ~row[w];
     }
 
-    // Check the next row.
-    if (row < schema.size() - 1) {
-        auto check_b = b > 0 ? b - 1 : b;
-        auto check_e = e < schema[row + 1].size() ? e + 1 : e;
-        if (is_symbol(schema, row + 1, check_b, check_e)) {
+    return w < words ? w * 64 + countr_zero(clear) : words * 64;
+}
+
+// Whether any bit in [b, e) of the row is set.
+static inline bool any_bit(const uint64_t *row, size_t b, size_t e) {
+    for (size_t w = b / 64; w * 64 < e; ++w) {
+        uint64_t bits = row[w];
+        if (w == b / 64) {
+            bits &= ~0UL << (b % 64);
+        }
+        if (w == (e - 1) / 64 && e % 64 != 0) {
+            bits &= ~(~0UL << (e % 64));
+        }
+        if (bits) {
             return true;
         }
     }
-
     return false;
 }
 
-unsigned long part_one(const vector<string> &schema) {
+/**
+ * Bit-parallel part one. The symbol masks are dilated by one cell in all eight
+ * directions with shifts and ORs, 64 cells at a time, and part numbers are the
+ * digit runs that intersect the dilated mask.
+ */
+unsigned long part_one_bitmap(const Schema &schema) {
+    RowMasks masks(schema);
+    const size_t words = masks.words;
+    vector<uint64_t> horizontal(masks.symbols.size());
+    vector<uint64_t> adjacent(masks.symbols.size());
     unsigned long sum = 0;
 
-    for (vector<string>::size_type row = 0; row < schema.size(); ++row) {
-        for (string::size_type col = 0; col < schema[row].size(); ++col) {
-            if (!isdigit(schema[row][col]) ||
-                (col > 0 && isdigit(schema[row][col - 1]))) {
-                continue;
-            }
+    // Dilate horizontally, carrying bits across word boundaries.
+    for (size_t base = 0; base < masks.symbols.size(); base += words) {
+        const uint64_t *s = masks.symbols.data() + base;
+        for (size_t w = 0; w < words; ++w) {
+            horizontal[base + w] = s[w] | (s[w] << 1) | (s[w] >> 1) |
+                                   (w > 0 ? s[w - 1] >> 63 : 0) |
+                                   (w + 1 < words ? s[w + 1] << 63 : 0);
+        }
+    }
 
-            // schema[row][col] is a digit. Find the entire number.
-            string::size_type b = col;
-            string::size_type e = col + 1;
-            while (e < schema[row].size() && isdigit(schema[row][e])) {
-                ++e;
-            }
+    // Dilate vertically.
+    for (size_t base = words; base + words < adjacent.size(); base += words) {
+        for (size_t w = 0; w < words; ++w) {
+            adjacent[base + w] = horizontal[base - words + w] |
+                                 horizontal[base + w] |
+                                 horizontal[base + words + w];
+        }
+    }
 
-            // Add to the sum if <row, b, e> is a part number.
-            if (is_part_number(schema, row, b, e)) {
-                sum += stoul(schema[row].substr(b, e - b));
+    for (size_t row = 0; row < schema.rows; ++row) {
+        const uint64_t *d = masks.row(masks.digits, row);
+        const uint64_t *a = masks.row(adjacent, row);
+        size_t off = schema.offset(row, 0);
+
+        for (size_t w = 0; w < words; ++w) {
+            // Runs of digits starting in this word.
+            uint64_t carry = w > 0 ? d[w - 1] >> 63 : 0;
+            uint64_t starts = d[w] & ~((d[w] << 1) | carry);
+            for (; starts; starts &= starts - 1) {
+                size_t b = w * 64 + countr_zero(starts);
+                size_t e = first_clear(d, words, b);
+                if (any_bit(a, b, e)) {
+                    sum += parse_number(schema, off + b, off + e);
+                }
             }
         }
     }
@@ -205,64 +344,90 @@ unsigned long part_one(const vector<string> &schema) {
     return sum;
 }
 
-static inline tuple<int, int, int>
-find_number_from_digit(const vector<string> &schema,
-                       vector<string>::size_type row,
-                       string::size_type col) {
-    // Find the adjacent number
-    auto b = col;
-    while (b > 0 && isdigit(schema[row][b - 1])) {
-        --b;
-    }
-    auto e = col + 1;
-    while (e < schema[row].size() && isdigit(schema[row][e])) {
-        ++e;
+/**
+ * Labeling of the numbers on the rows [first_row, last_row) of the schematic
+ * and on the rows right above and below them: every digit cell holds the ID of
+ * the number it belongs to (0 for other cells), and the value of number i is
+ * values[i].
+ */
+class NumberLabels {
+public:
+    size_t base; // Offset of the first labeled cell
+    vector<uint32_t> labels;
+    vector<unsigned long> values{0};
+
+    NumberLabels(const Schema &schema, size_t first_row, size_t last_row)
+        : base(schema.offset(first_row - 1L, -1)),
+          labels((last_row - first_row + 2) * schema.stride) {
+        size_t halo_first = first_row > 0 ? first_row - 1 : 0;
+        size_t halo_last = min(last_row + 1, schema.rows);
+
+        for (size_t row = halo_first; row < halo_last; ++row) {
+            size_t row_end = schema.offset(row, schema.cols);
+            for (size_t b = schema.offset(row, 0); b < row_end; ++b) {
+                if (!isdigit(schema[b])) {
+                    continue;
+                }
+
+                unsigned long num = 0;
+                for (; isdigit(schema[b]); ++b) {
+                    num = num * 10 + (schema[b] - '0');
+                    labels[b - base] = values.size();
+                }
+                values.push_back(num);
+            }
+        }
     }
-    return {row, b, e};
-}
 
-static inline bool is_gear(const vector<string> &schema,
-                           vector<string>::size_type row,
-                           string::size_type col,
+    uint32_t operator[](size_t off) const { return labels[off - base]; }
+};
+
+static inline bool is_gear(const Schema &schema,
+                           const NumberLabels &numbers,
+                           size_t off,
                            unsigned long &gear_product) {
-    set<tuple<int, int, int>> adjacent_numbers;
-    auto row_b = row > 0 ? row - 1 : row;
-    auto row_e = row < schema.size() - 1 ? row + 2 : row + 1;
-    auto col_b = col > 0 ? col - 1 : col;
-    auto col_e = col < schema[row].size() - 1 ? col + 2 : col + 1;
-
-    for (auto i = row_b; i < row_e; ++i) {
-        for (auto j = col_b; j < col_e; ++j) {
-            if (isdigit(schema[i][j])) {
-                adjacent_numbers.insert(find_number_from_digit(schema, i, j));
-            }
+    const size_t neighbors[] = {
+        off - schema.stride - 1, off - schema.stride, off - schema.stride + 1,
+        off - 1,                 off + 1,             off + schema.stride - 1,
+        off + schema.stride,     off + schema.stride + 1,
+    };
+    uint32_t adjacent_numbers[size(neighbors)];
+    size_t num_adjacent = 0;
+
+    for (auto i : neighbors) {
+        uint32_t label = numbers[i];
+        if (label != 0 && find(adjacent_numbers,
+                               adjacent_numbers + num_adjacent,
+                               label) == adjacent_numbers + num_adjacent) {
+            adjacent_numbers[num_adjacent++] = label;
         }
     }
 
-    if (adjacent_numbers.size() != 2) {
+    if (num_adjacent != 2) {
         return false;
     }
 
     // Compute the gear product
-    gear_product = 1;
-    for (auto [r, b, e] : adjacent_numbers) {
-        auto num = stoul(schema[r].substr(b, e - b));
-        gear_product *= num;
-    }
-
+    gear_product = numbers.values[adjacent_numbers[0]] *
+                   numbers.values[adjacent_numbers[1]];
     return true;
 }
 
-unsigned long part_two(const vector<string> &schema) {
+// Sums the ratios of the gears on the rows [first_row, last_row).
+static unsigned long
+sum_gear_ratios(const Schema &schema, size_t first_row, size_t last_row) {
     unsigned long sum = 0;
-    for (vector<string>::size_type row = 0; row < schema.size(); ++row) {
-        for (string::size_type col = 0; col < schema[row].size(); ++col) {
-            if (schema[row][col] != '*') {
+    NumberLabels numbers(schema, first_row, last_row);
+
+    for (size_t row = first_row; row < last_row; ++row) {
+        size_t row_end = schema.offset(row, schema.cols);
+        for (size_t off = schema.offset(row, 0); off < row_end; ++off) {
+            if (schema[off] != '*') {
                 continue;
             }
 
             unsigned long gear_product = 0;
-            if (is_gear(schema, row, col, gear_product)) {
+            if (is_gear(schema, numbers, off, gear_product)) {
                 sum += gear_product;
             }
         }
@@ -270,22 +435,636 @@ unsigned long part_two(const vector<string> &schema) {
     return sum;
 }
 
+/**
+ * Splits the schematic into horizontal bands of rows and sums each band on its
+ * own thread. A band reads the rows right above and below it as halo rows, but
+ * only counts the numbers and gears on its own rows, so that each of them is
+ * counted exactly once.
+ */
+template <class F>
+static unsigned long
+parallel_sum(const Schema &schema, unsigned num_threads, F sum_rows) {
+    size_t num_bands = max<size_t>(min<size_t>(num_threads, schema.rows), 1);
+    vector<unsigned long> partials(num_bands);
+    vector<thread> workers;
+
+    auto band = [&](size_t i) {
+        partials[i] = sum_rows(schema, schema.rows * i / num_bands,
+                               schema.rows * (i + 1) / num_bands);
+    };
+
+    for (size_t i = 1; i < num_bands; ++i) {
+        workers.emplace_back(band, i);
+    }
+    band(0);
+    for (auto &worker : workers) {
+        worker.join();
+    }
+
+    unsigned long sum = 0;
+    for (auto partial : partials) {
+        sum += partial;
+    }
+    return sum;
+}
+
+unsigned long part_one(const Schema &schema, unsigned num_threads) {
+    return parallel_sum(schema, num_threads, sum_part_numbers);
+}
+
+unsigned long part_two(const Schema &schema, unsigned num_threads) {
+    return parallel_sum(schema, num_threads, sum_gear_ratios);
+}
+
+/**
+ * Bipartite adjacency between the symbol cells and the numbers of the
+ * schematic in compressed sparse row form: the numbers adjacent to symbol i
+ * are neighbors[offsets[i]] to neighbors[offsets[i + 1] - 1], as indices into
+ * values. Queries run over these arrays instead of rescanning the grid.
+ */
+class AdjacencyIndex {
+public:
+    vector<unsigned long> values; // Value of each number (index 0 is unused)
+    vector<char> symbols;         // Symbol of each symbol cell
+    vector<uint32_t> offsets{0};
+    vector<uint32_t> neighbors;
+
+    explicit AdjacencyIndex(const Schema &schema) {
+        NumberLabels numbers(schema, 0, schema.rows);
+        values = move(numbers.values);
+
+        for (size_t row = 0; row < schema.rows; ++row) {
+            size_t row_end = schema.offset(row, schema.cols);
+            for (size_t off = schema.offset(row, 0); off < row_end; ++off) {
+                if (!is_symbol(schema[off])) {
+                    continue;
+                }
+
+                size_t first = neighbors.size();
+                for (auto row_off :
+                     {off - schema.stride, off, off + schema.stride}) {
+                    for (auto i = row_off - 1; i <= row_off + 1; ++i) {
+                        uint32_t label = numbers[i];
+                        if (label != 0 && find(neighbors.begin() + first,
+                                               neighbors.end(),
+                                               label) == neighbors.end()) {
+                            neighbors.push_back(label);
+                        }
+                    }
+                }
+                symbols.push_back(schema[off]);
+                offsets.push_back(neighbors.size());
+            }
+        }
+    }
+
+    /**
+     * @return the sum, over the cells of the symbol with exactly k adjacent
+     * numbers, of the products of those numbers.
+     */
+    unsigned long sum_products(char symbol, size_t k) const {
+        unsigned long sum = 0;
+        for (size_t i = 0; i < symbols.size(); ++i) {
+            if (symbols[i] != symbol || offsets[i + 1] - offsets[i] != k) {
+                continue;
+            }
+            unsigned long product = 1;
+            for (auto j = offsets[i]; j < offsets[i + 1]; ++j) {
+                product *= values[neighbors[j]];
+            }
+            sum += product;
+        }
+        return sum;
+    }
+
+    // Sums the numbers adjacent to any cell of the symbols in the set.
+    unsigned long sum_adjacent(string_view symbol_set) const {
+        bool in_set[256] = {};
+        vector<bool> counted(values.size());
+        unsigned long sum = 0;
+
+        for (unsigned char c : symbol_set) {
+            in_set[c] = true;
+        }
+
+        for (size_t i = 0; i < symbols.size(); ++i) {
+            if (!in_set[static_cast<unsigned char>(symbols[i])]) {
+                continue;
+            }
+            for (auto j = offsets[i]; j < offsets[i + 1]; ++j) {
+                if (!counted[neighbors[j]]) {
+                    counted[neighbors[j]] = true;
+                    sum += values[neighbors[j]];
+                }
+            }
+        }
+        return sum;
+    }
+
+    // All the distinct symbols in the schematic.
+    string symbol_set() const {
+        bool seen[256] = {};
+        string set;
+        for (unsigned char c : symbols) {
+            if (!seen[c]) {
+                seen[c] = true;
+                set += c;
+            }
+        }
+        return set;
+    }
+};
+
+// Returns the cells [b, e) of the number containing the digit at `off`.
+static inline pair<size_t, size_t> find_number_from_digit(const Schema &schema,
+                                                          size_t off) {
+    auto b = off;
+    while (isdigit(schema[b - 1])) {
+        --b;
+    }
+    auto e = off + 1;
+    while (isdigit(schema[e])) {
+        ++e;
+    }
+    return {b, e};
+}
+
+// Returns the gear ratio of the cell, or 0 if it's not a gear.
+static inline unsigned long gear_ratio(const Schema &schema, size_t off) {
+    if (schema[off] != '*') {
+        return 0;
+    }
+
+    pair<size_t, size_t> adjacent_numbers[8];
+    size_t num_adjacent = 0;
+
+    for (auto row_off : {off - schema.stride, off, off + schema.stride}) {
+        for (auto i = row_off - 1; i <= row_off + 1; ++i) {
+            if (!isdigit(schema[i])) {
+                continue;
+            }
+            auto number = find_number_from_digit(schema, i);
+            if (find(adjacent_numbers, adjacent_numbers + num_adjacent,
+                     number) == adjacent_numbers + num_adjacent) {
+                adjacent_numbers[num_adjacent++] = number;
+            }
+        }
+    }
+
+    if (num_adjacent != 2) {
+        return 0;
+    }
+
+    auto [b0, e0] = adjacent_numbers[0];
+    auto [b1, e1] = adjacent_numbers[1];
+    return parse_number(schema, b0, e0) * parse_number(schema, b1, e1);
+}
+
+/**
+ * Schematic that keeps its part-number and gear-ratio sums up to date as cells
+ * are edited. An edit re-evaluates only the numbers crossing the 3x3
+ * neighborhood of the cell and the gears next to those numbers: their
+ * contributions are taken out before the edit and added back after it.
+ */
+class IncrementalSchema {
+public:
+    explicit IncrementalSchema(Schema _schema)
+        : schema(move(_schema)), parts(part_one(schema, 1)),
+          gears(part_two(schema, 1)) {}
+
+    unsigned long part_sum() const { return parts; }
+    unsigned long gear_sum() const { return gears; }
+
+    void set_cell(size_t row, size_t col, char c) {
+        if (row >= schema.rows || col >= schema.cols) {
+            throw out_of_range("Cell out of the schematic: (" +
+                               to_string(row) + ", " + to_string(col) + ")");
+        }
+
+        size_t off = schema.offset(row, col);
+        collect(off);
+
+        for (auto [b, e] : span(numbers, num_numbers)) {
+            if (is_part_number(schema, b, e)) {
+                parts -= parse_number(schema, b, e);
+            }
+        }
+        for (auto gear : gear_cells) {
+            gears -= gear_ratio(schema, gear);
+        }
+
+        schema.cells[off] = c;
+        // The numbers now crossing the neighborhood are made of the cell and
+        // the digits of the numbers before, so the gears next to them have
+        // been collected already.
+        find_numbers(off);
+
+        for (auto [b, e] : span(numbers, num_numbers)) {
+            if (is_part_number(schema, b, e)) {
+                parts += parse_number(schema, b, e);
+            }
+        }
+        for (auto gear : gear_cells) {
+            gears += gear_ratio(schema, gear);
+        }
+    }
+
+private:
+    Schema schema;
+    unsigned long parts;
+    unsigned long gears;
+    pair<size_t, size_t> numbers[6]; // Numbers crossing the neighborhood
+    size_t num_numbers = 0;
+    vector<size_t> gear_cells; // Cells that may be gears, kept for reuse
+
+    void find_numbers(size_t off) {
+        num_numbers = 0;
+        for (auto row_off : {off - schema.stride, off, off + schema.stride}) {
+            for (auto i = row_off - 1; i <= row_off + 1; ++i) {
+                // Count each number once, at its first digit in the row.
+                if (isdigit(schema[i]) &&
+                    (i == row_off - 1 || !isdigit(schema[i - 1]))) {
+                    numbers[num_numbers++] = find_number_from_digit(schema, i);
+                }
+            }
+        }
+    }
+
+    // Collects the numbers crossing the neighborhood of the cell, and the cell
+    // along with the '*' cells next to the cell or to those numbers.
+    void collect(size_t off) {
+        find_numbers(off);
+        gear_cells.assign(1, off);
+
+        auto add_gears = [&](size_t b, size_t e) {
+            for (auto row_b : {b - schema.stride, b, b + schema.stride}) {
+                for (auto i = row_b - 1; i <= row_b + (e - b); ++i) {
+                    if (schema[i] == '*') {
+                        gear_cells.push_back(i);
+                    }
+                }
+            }
+        };
+
+        add_gears(off, off + 1);
+        for (auto [b, e] : span(numbers, num_numbers)) {
+            add_gears(b, e);
+        }
+
+        sort(gear_cells.begin(), gear_cells.end());
+        gear_cells.erase(unique(gear_cells.begin(), gear_cells.end()),
+                         gear_cells.end());
+    }
+};
+
+// A row of the schematic in a sliding window, with one '.' cell on each side,
+// and the labels of its numbers (see NumberLabels).
+class WindowRow {
+public:
+    string cells;
+    vector<uint32_t> labels;
+    vector<unsigned long> values{0};
+
+    void load(string_view line, size_t cols) {
+        cells.assign(cols + 2, '.');
+        line.copy(cells.data() + 1, line.size());
+        labels.assign(cols + 2, 0);
+        values.resize(1);
+
+        for (size_t b = 1; b <= cols; ++b) {
+            if (!isdigit(cells[b])) {
+                continue;
+            }
+
+            unsigned long num = 0;
+            for (; isdigit(cells[b]); ++b) {
+                num = num * 10 + (cells[b] - '0');
+                labels[b] = values.size();
+            }
+            values.push_back(num);
+        }
+    }
+
+    void widen(size_t cols) {
+        cells.resize(cols + 2, '.');
+        labels.resize(cols + 2, 0);
+    }
+};
+
+/**
+ * Part-number and gear-ratio sums of a schematic that is streamed row by row.
+ * Only the previous, current, and next rows are kept in a ring of buffers, and
+ * each row is evaluated once its next row arrives, so memory is O(width).
+ */
+class SchemaWindow {
+public:
+    unsigned long part_sum = 0;
+    unsigned long gear_sum = 0;
+
+    void push(string_view line) {
+        if (line.size() > cols) {
+            cols = line.size();
+            for (auto &row : ring) {
+                row.widen(cols);
+            }
+        }
+
+        row(num_rows).load(line, cols);
+        evaluate(row(num_rows - 2), row(num_rows - 1), row(num_rows));
+        ++num_rows;
+    }
+
+    void finish() {
+        if (num_rows > 0) {
+            row(num_rows).load("", cols);
+            evaluate(row(num_rows - 2), row(num_rows - 1), row(num_rows));
+        }
+    }
+
+private:
+    WindowRow ring[3];
+    long num_rows = 0;
+    size_t cols = 0;
+
+    // Row -1 maps to a slot that is empty until row 2 arrives.
+    WindowRow &row(long r) { return ring[(r + 3) % 3]; }
+
+    void evaluate(const WindowRow &prev,
+                  const WindowRow &cur,
+                  const WindowRow &next) {
+        auto any_symbol = [](const WindowRow &row, size_t b, size_t e) {
+            return any_of(row.cells.begin() + b, row.cells.begin() + e,
+                          [](char c) { return is_symbol(c); });
+        };
+
+        for (size_t b = 1; b <= cols; ++b) {
+            if (isdigit(cur.cells[b]) && !isdigit(cur.cells[b - 1])) {
+                size_t e = b + 1;
+                while (isdigit(cur.cells[e])) {
+                    ++e;
+                }
+                if (any_symbol(prev, b - 1, e + 1) ||
+                    is_symbol(cur.cells[b - 1]) || is_symbol(cur.cells[e]) ||
+                    any_symbol(next, b - 1, e + 1)) {
+                    part_sum += cur.values[cur.labels[b]];
+                }
+            } else if (cur.cells[b] == '*') {
+                gear_sum += gear_ratio(prev, cur, next, b);
+            }
+        }
+    }
+
+    // Returns the gear ratio of the '*' at column b, or 0 if it's not a gear.
+    static unsigned long gear_ratio(const WindowRow &prev,
+                                    const WindowRow &cur,
+                                    const WindowRow &next,
+                                    size_t b) {
+        const pair<const WindowRow *, size_t> neighbors[] = {
+            {&prev, b - 1}, {&prev, b}, {&prev, b + 1}, {&cur, b - 1},
+            {&cur, b + 1},  {&next, b - 1}, {&next, b}, {&next, b + 1},
+        };
+        pair<const WindowRow *, uint32_t> adjacent_numbers[size(neighbors)];
+        size_t num_adjacent = 0;
+
+        for (auto [row, col] : neighbors) {
+            pair<const WindowRow *, uint32_t> number{row, row->labels[col]};
+            if (number.second != 0 &&
+                find(adjacent_numbers, adjacent_numbers + num_adjacent,
+                     number) == adjacent_numbers + num_adjacent) {
+                adjacent_numbers[num_adjacent++] = number;
+            }
+        }
+
+        if (num_adjacent != 2) {
+            return 0;
+        }
+
+        auto [row_a, label_a] = adjacent_numbers[0];
+        auto [row_b, label_b] = adjacent_numbers[1];
+        return row_a->values[label_a] * row_b->values[label_b];
+    }
+};
+
+// Streams the schematic from the file, or stdin if it's "-".
+static inline SchemaWindow stream_schema(const string &filename) {
+    SchemaWindow window;
+    string line;
+    ifstream ifs;
+    istream &is = filename == "-" ? cin : (ifs.open(filename), ifs);
+
+    while (getline(is, line)) {
+        window.push(line);
+    }
+    window.finish();
+
+    return window;
+}
+
+/**
+ * Sparse schematic for grids that are mostly '.': each row is stored as its
+ * sorted digit spans and symbol cells only (rows index into the arrays through
+ * offsets), and adjacency is found by merge-walking neighboring rows. Memory
+ * and evaluation time scale with the number of non-empty cells.
+ */
+class SparseSchema {
+public:
+    struct Number {
+        size_t b, e; // Columns [b, e)
+        unsigned long value;
+    };
+
+    struct Symbol {
+        size_t col;
+        char c;
+    };
+
+    vector<Number> numbers;
+    vector<Symbol> symbols;
+    vector<size_t> number_offsets{0}; // Numbers of row r start here
+    vector<size_t> symbol_offsets{0}; // Symbols of row r start here
+
+    explicit SparseSchema(istream &is) {
+        string line;
+
+        while (getline(is, line)) {
+            for (size_t col = line.find_first_not_of('.');
+                 col != string::npos;
+                 col = line.find_first_not_of('.', col)) {
+                if (!isdigit(line[col])) {
+                    symbols.push_back({col, line[col]});
+                    ++col;
+                    continue;
+                }
+
+                Number number{col, col, 0};
+                for (; number.e < line.size() && isdigit(line[number.e]);
+                     ++number.e) {
+                    number.value = number.value * 10 + (line[number.e] - '0');
+                }
+                numbers.push_back(number);
+                col = number.e;
+            }
+            number_offsets.push_back(numbers.size());
+            symbol_offsets.push_back(symbols.size());
+        }
+    }
+
+    size_t rows() const { return number_offsets.size() - 1; }
+
+    unsigned long part_sum() const {
+        unsigned long sum = 0;
+
+        for (size_t row = 0; row < rows(); ++row) {
+            // One cursor into the symbols of each neighboring row.
+            size_t cursors[3], ends[3];
+            for (size_t i = 0; i < 3; ++i) {
+                bool valid = row + i >= 1 && row + i - 1 < rows();
+                cursors[i] = valid ? symbol_offsets[row + i - 1] : 0;
+                ends[i] = valid ? symbol_offsets[row + i] : 0;
+            }
+
+            for (auto n = number_offsets[row]; n < number_offsets[row + 1];
+                 ++n) {
+                const Number &number = numbers[n];
+                for (size_t i = 0; i < 3; ++i) {
+                    while (cursors[i] < ends[i] &&
+                           symbols[cursors[i]].col + 1 < number.b) {
+                        ++cursors[i];
+                    }
+                    if (cursors[i] < ends[i] &&
+                        symbols[cursors[i]].col <= number.e) {
+                        sum += number.value;
+                        break;
+                    }
+                }
+            }
+        }
+
+        return sum;
+    }
+
+    unsigned long gear_sum() const {
+        unsigned long sum = 0;
+
+        for (size_t row = 0; row < rows(); ++row) {
+            // One cursor into the numbers of each neighboring row.
+            size_t cursors[3], ends[3];
+            for (size_t i = 0; i < 3; ++i) {
+                bool valid = row + i >= 1 && row + i - 1 < rows();
+                cursors[i] = valid ? number_offsets[row + i - 1] : 0;
+                ends[i] = valid ? number_offsets[row + i] : 0;
+            }
+
+            for (auto s = symbol_offsets[row]; s < symbol_offsets[row + 1];
+                 ++s) {
+                if (symbols[s].c != '*') {
+                    continue;
+                }
+
+                size_t col = symbols[s].col;
+                size_t num_adjacent = 0;
+                unsigned long gear_product = 1;
+                for (size_t i = 0; i < 3; ++i) {
+                    while (cursors[i] < ends[i] &&
+                           numbers[cursors[i]].e < col) {
+                        ++cursors[i];
+                    }
+                    for (auto n = cursors[i];
+                         n < ends[i] && numbers[n].b <= col + 1; ++n) {
+                        ++num_adjacent;
+                        gear_product *= numbers[n].value;
+                    }
+                }
+
+                if (num_adjacent == 2) {
+                    sum += gear_product;
+                }
+            }
+        }
+
+        return sum;
+    }
+};
+
+// Applies the cell updates, one "<row> <col> <char>" per line, and prints the
+// answer after each of them.
+void apply_updates(Schema schema, const string &updates_filename, int mode) {
+    IncrementalSchema incremental(move(schema));
+    ifstream ifs(updates_filename);
+    size_t row, col;
+    char c;
+
+    while (ifs >> row >> col >> c) {
+        incremental.set_cell(row, col, c);
+        cout << (mode == 1 ? incremental.part_sum() : incremental.gear_sum())
+             << endl;
+    }
+}
+
 int main(int argc, char **argv) {
-    if (argc != 3) {
-        cerr << "There must be exactly 3 arguments." << endl;
+    if (argc < 3 || argc % 2 == 0) {
+        cerr << "Usage: " << argv[0]
+             << " <mode> <input> [-e <engine>] [-j <threads>] [-u <updates>]"
+             << endl;
         return -1;
     }
 
     int mode = stoi(argv[1]);
     string filename(argv[2]);
-    vector<string> schema = read_schema(filename);
+    string_view engine = "grid";
+    unsigned num_threads = 1;
+    string updates_filename;
+
+    for (int i = 3; i < argc; i += 2) {
+        string_view option(argv[i]);
+        if (option == "-e") {
+            engine = argv[i + 1];
+        } else if (option == "-j") {
+            // Zero threads means one per hardware thread.
+            num_threads = stoul(argv[i + 1]);
+            if (num_threads == 0) {
+                num_threads = max(thread::hardware_concurrency(), 1U);
+            }
+        } else if (option == "-u") {
+            updates_filename = argv[i + 1];
+        } else {
+            cerr << "Unknown option: " << option << endl;
+            return -1;
+        }
+    }
+
+    if (engine == "stream" && (mode == 1 || mode == 2)) {
+        SchemaWindow window = stream_schema(filename);
+        cout << (mode == 1 ? window.part_sum : window.gear_sum) << endl;
+        return 0;
+    }
+
+    if (engine == "sparse" && (mode == 1 || mode == 2)) {
+        ifstream ifs(filename);
+        SparseSchema sparse(ifs);
+        cout << (mode == 1 ? sparse.part_sum() : sparse.gear_sum()) << endl;
+        return 0;
+    }
+
+    Schema schema = read_schema(filename);
 
-    if (mode == 1) {
-        cout << part_one(schema) << endl;
-    } else if (mode == 2) {
-        cout << part_two(schema) << endl;
+    if (engine == "grid" && !updates_filename.empty() &&
+        (mode == 1 || mode == 2)) {
+        apply_updates(move(schema), updates_filename, mode);
+    } else if (engine == "grid" && mode == 1) {
+        cout << part_one(schema, num_threads) << endl;
+    } else if (engine == "grid" && mode == 2) {
+        cout << part_two(schema, num_threads) << endl;
+    } else if (engine == "csr" && mode == 1) {
+        AdjacencyIndex index(schema);
+        cout << index.sum_adjacent(index.symbol_set()) << endl;
+    } else if (engine == "csr" && mode == 2) {
+        cout << AdjacencyIndex(schema).sum_products('*', 2) << endl;
+    } else if (engine == "bitmap" && mode == 1) {
+        cout << part_one_bitmap(schema) << endl;
     } else {
-        cerr << "Unknown mode (must be either 1 or 2): " << mode << endl;
+        cerr << "Unknown mode (must be either 1 or 2) for engine " << engine
+             << ": " << mode << endl;
         return -1;
     }
 
@@ -121,71 +121,231 @@
  *
  */
 
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
 #include <fstream>
 #include <iostream>
-#include <list>
-#include <ostream>
-#include <sstream>
+#include <span>
+#include <stdexcept>
 #include <string>
 #include <string_view>
-#include <unordered_set>
+#include <thread>
 #include <vector>
 
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
 using namespace std;
 
-static inline void strip_colon(string &line) {
-    unsigned long colon_pos = line.find(':');
-    line.erase(0, colon_pos + 1);
+// Set of card numbers in [0, capacity) as a fixed-size bitset.
+class NumberSet {
+public:
+    static constexpr int capacity = 256;
+
+    void insert(int num) { words[num / 64] |= 1UL << (num % 64); }
+
+    bool contains(int num) const {
+        return (words[num / 64] >> (num % 64)) & 1;
+    }
+
+private:
+    uint64_t words[capacity / 64] = {};
+};
+
+// Parses the next number in the line starting from i, skipping spaces, and
+// stops at anything else. Returns false if there is no number.
+static inline bool next_number(string_view line, size_t &i, int &num) {
+    while (i < line.size() && line[i] == ' ') {
+        ++i;
+    }
+    if (i >= line.size() || !isdigit(line[i])) {
+        return false;
+    }
+
+    num = 0;
+    while (i < line.size() && isdigit(line[i])) {
+        num = num * 10 + (line[i++] - '0');
+    }
+    if (num >= NumberSet::capacity) {
+        throw out_of_range("Card number out of range: " + to_string(num));
+    }
+    return true;
 }
 
-static inline unordered_set<int> get_and_strip_winning_numbers(string &line) {
-    unordered_set<int> winning_numbers;
-    unsigned long bar_pos = line.find('|');
-    istringstream iss{line.substr(0, bar_pos)};
-    string num_str;
+// Returns the number of card numbers that are winning numbers.
+static inline int count_wins(string_view line) {
+    NumberSet winning_numbers;
+    size_t i = line.find(':') + 1;
+    int num;
+    int wins = 0;
 
-    while (getline(iss, num_str, ' ')) {
-        if (num_str.empty()) {
-            continue;
-        }
-        winning_numbers.insert(stoi(num_str));
+    while (next_number(line, i, num)) {
+        winning_numbers.insert(num);
+    }
+
+    ++i; // Skip the '|'
+    while (next_number(line, i, num)) {
+        wins += winning_numbers.contains(num);
     }
 
-    line.erase(0, bar_pos + 1);
-    return winning_numbers;
+    return wins;
 }
 
-static inline vector<int> get_card_numbers(const string_view line) {
-    vector<int> numbers;
-    string num_str;
-    istringstream iss{string{line}};
+#if defined(__SSE2__)
+/**
+ * Parses n fields of the form " NN" or "  N" starting at p, five fields per
+ * 16-byte load: a shuffle gathers the two digit characters of each field and
+ * a multiply-add combines them into a number. Returns false if a field doesn't
+ * fit the form. Up to 16 bytes past the last field are read.
+ */
+__attribute__((target("ssse3"))) static inline bool
+parse_fields_ssse3(const char *p, int n, uint16_t *nums) {
+    const __m128i gather_digits =
+        _mm_setr_epi8(1, 2, 4, 5, 7, 8, 10, 11, 13, 14, -1, -1, -1, -1, -1, -1);
+    const __m128i gather_spaces = _mm_setr_epi8(0, 3, 6, 9, 12, -1, -1, -1, -1,
+                                                -1, -1, -1, -1, -1, -1, -1);
+    const __m128i tens = _mm_setr_epi8(-1, 0, -1, 0, -1, 0, -1, 0, -1, 0, 0, 0,
+                                       0, 0, 0, 0);
+    const __m128i weights =
+        _mm_setr_epi8(10, 1, 10, 1, 10, 1, 10, 1, 10, 1, 0, 0, 0, 0, 0, 0);
+    const __m128i zero = _mm_set1_epi8('0');
+    const __m128i space = _mm_set1_epi8(' ');
+
+    for (int k = 0; k < n; k += 5) {
+        __m128i chunk =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 3 * k));
+        __m128i digits = _mm_shuffle_epi8(chunk, gather_digits);
+        __m128i spaces = _mm_shuffle_epi8(chunk, gather_spaces);
 
-    while (getline(iss, num_str, ' ')) {
-        if (num_str.empty()) {
-            continue;
+        // Every digit must be a digit, except that the tens may be blank.
+        __m128i values = _mm_sub_epi8(digits, zero);
+        __m128i is_digit = _mm_cmpeq_epi8(
+            _mm_min_epu8(values, _mm_set1_epi8(9)), values);
+        __m128i is_blank =
+            _mm_and_si128(_mm_cmpeq_epi8(digits, space), tens);
+        int m = min(n - k, 5);
+        int digit_mask = (1 << (2 * m)) - 1;
+        int space_mask = (1 << m) - 1;
+        if ((_mm_movemask_epi8(_mm_or_si128(is_digit, is_blank)) &
+             digit_mask) != digit_mask ||
+            (_mm_movemask_epi8(_mm_cmpeq_epi8(spaces, space)) & space_mask) !=
+                space_mask) {
+            return false;
         }
-        numbers.push_back(stoi(num_str));
+
+        // Blanks saturate to 0.
+        alignas(16) uint16_t fields[8];
+        _mm_store_si128(
+            reinterpret_cast<__m128i *>(fields),
+            _mm_maddubs_epi16(_mm_subs_epu8(digits, zero), weights));
+        copy(fields, fields + m, nums + k);
     }
 
-    return numbers;
+    return true;
 }
+#endif
+
+/**
+ * Counts the wins of cards that share the fixed-width layout of the first
+ * line, "Card NNN:" followed by two-character numbers separated by spaces and
+ * a '|'. Lines with that layout are parsed at fixed offsets with SIMD, and
+ * anything else falls back to the generic parser.
+ */
+class CardLayout {
+public:
+    static constexpr size_t max_length = 240;
+
+    int count_wins(string_view line) {
+        if (!learned) {
+            learned = true;
+            fixed = learn(line);
+        }
+#if defined(__SSE2__)
+        int wins;
+        if (fixed && fits(line) && count_fixed(line, wins)) {
+            return wins;
+        }
+#endif
+        return ::count_wins(line);
+    }
+
+private:
+    // The winning numbers are the fields between the colon and the bar, which
+    // is preceded by a space, and the card numbers are the fields after it.
+    bool learn(string_view line) {
+#if defined(__SSE2__)
+        if (!__builtin_cpu_supports("ssse3")) {
+            return false;
+        }
+#endif
+        colon = line.find(':');
+        bar = line.find('|');
+        length = line.size();
+        if (colon == string_view::npos || bar == string_view::npos ||
+            bar < colon + 2 || length > max_length) {
+            return false;
+        }
+        if ((bar - colon - 2) % 3 != 0 || (length - bar - 1) % 3 != 0) {
+            return false;
+        }
+        num_winning = (bar - colon - 2) / 3;
+        num_card = (length - bar - 1) / 3;
+        return true;
+    }
+
+    bool fits(string_view line) const {
+        return line.size() == length && line[colon] == ':' &&
+               line[bar - 1] == ' ' && line[bar] == '|';
+    }
+
+#if defined(__SSE2__)
+    __attribute__((target("ssse3"))) bool count_fixed(string_view line,
+                                                      int &wins) const {
+        alignas(16) char padded[max_length + 16];
+        uint16_t nums[max_length / 3];
+        NumberSet winning_numbers;
+
+        memcpy(padded, line.data(), length);
+        memset(padded + length, 0, 16);
+
+        if (!parse_fields_ssse3(padded + colon + 1, num_winning, nums)) {
+            return false;
+        }
+        for (int i = 0; i < num_winning; ++i) {
+            winning_numbers.insert(nums[i]);
+        }
+
+        if (!parse_fields_ssse3(padded + bar + 1, num_card, nums)) {
+            return false;
+        }
+        wins = 0;
+        for (int i = 0; i < num_card; ++i) {
+            wins += winning_numbers.contains(nums[i]);
+        }
+        return true;
+    }
+#endif
+
+    bool learned = false;
+    bool fixed = false;
+    size_t colon = 0;
+    size_t bar = 0;
+    size_t length = 0;
+    int num_winning = 0;
+    int num_card = 0;
+};
 
 unsigned long part_one(const string_view filename) {
     unsigned long sum = 0;
+    CardLayout layout;
     string line;
     ifstream ifs(string{filename});
 
     while (getline(ifs, line)) {
-        strip_colon(line);
-        auto winning_numbers = get_and_strip_winning_numbers(line);
-        auto card_numbers = get_card_numbers(line);
-        int wins = 0;
-
-        for (auto num : card_numbers) {
-            if (winning_numbers.contains(num)) {
-                ++wins;
-            }
-        }
+        int wins = layout.count_wins(line);
 
         if (wins > 0) {
             sum += 1UL << (wins - 1);
@@ -195,62 +355,251 @@ unsigned long part_one(const string_view filename) {
     return sum;
 }
 
-unsigned long part_two(const string_view filename) {
-    unsigned long sum = 0; // Total number of cards
-    list<int> num_copies;
+#if defined(ENABLE_WIDE_COUNTS)
+using card_count_t = unsigned __int128;
+
+ostream &operator<<(ostream &os, unsigned __int128 value) {
+    char digits[40];
+    char *p = digits + sizeof(digits);
+    do {
+        *--p = '0' + static_cast<int>(value % 10);
+        value /= 10;
+    } while (value > 0);
+    return os << string_view(p, digits + sizeof(digits) - p);
+}
+#else
+using card_count_t = uint64_t;
+#endif
+
+/**
+ * Pending copies of the upcoming cards, in a fixed-capacity ring buffer. A card
+ * can win at most one copy of each of the next `capacity` cards (one per
+ * distinct card number), so the window never grows.
+ */
+template <class Count>
+class CopyWindow {
+public:
+    static constexpr size_t capacity = NumberSet::capacity;
+
+    // Returns the instances (the original and its copies) of the next card and
+    // slides the window past it.
+    Count next() {
+        Count instances = 1 + pending[head];
+        pending[head] = 0;
+        head = (head + 1) % capacity;
+        return instances;
+    }
+
+    // Adds `copies` copies of each of the next `wins` cards.
+    void win(int wins, Count copies) {
+        if (static_cast<size_t>(wins) > capacity) {
+            throw length_error("Too many wins for a card: " + to_string(wins));
+        }
+        for (int i = 0; i < wins; ++i) {
+            pending[(head + i) % capacity] += copies;
+        }
+    }
+
+private:
+    Count pending[capacity] = {};
+    size_t head = 0;
+};
+
+card_count_t part_two(const string_view filename) {
+    card_count_t sum = 0; // Total number of cards
+    CopyWindow<card_count_t> num_copies;
+    CardLayout layout;
     string line;
     ifstream ifs(string{filename});
 
     while (getline(ifs, line)) {
-        int num_current_cards = 1;
+        card_count_t num_current_cards = num_copies.next();
+        num_copies.win(layout.count_wins(line), num_current_cards);
+        sum += num_current_cards;
+    }
+
+    return sum;
+}
+
+/**
+ * Running totals of a live feed of scratchcards. Cards are added one line at a
+ * time, and the only state besides the totals and the learned line layout is
+ * the bounded window of pending copies, so a session can run indefinitely.
+ */
+class ScratchcardSession {
+public:
+    // Scores the card and adds its instances, including the copies won by the
+    // cards before it.
+    void add(string_view line) {
+        int wins = layout.count_wins(line);
+        card_count_t instances = copies.next();
+
+        copies.win(wins, instances);
+        if (wins > 0) {
+            total_points += 1UL << (wins - 1);
+        }
+        total_cards += instances;
+    }
+
+    unsigned long points() const { return total_points; }
+    card_count_t cards() const { return total_cards; }
+
+private:
+    CopyWindow<card_count_t> copies;
+    CardLayout layout;
+    unsigned long total_points = 0;
+    card_count_t total_cards = 0;
+};
+
+// Feeds the cards to a session and prints both totals after every card. Reads
+// from stdin if the filename is "-".
+void run_session(const string_view filename) {
+    ScratchcardSession session;
+    string line;
+    ifstream ifs;
+    istream &is = filename == "-" ? cin : (ifs.open(string{filename}), ifs);
+
+    while (getline(is, line)) {
+        session.add(line);
+        cout << session.points() << ' ' << session.cards() << '\n';
+    }
+    cout << flush;
+}
+
+static inline string read_file(const string_view filename) {
+    string buffer;
+    ifstream ifs(string{filename}, ios::binary | ios::ate);
+
+    if (!ifs) {
+        return buffer;
+    }
+
+    buffer.resize(ifs.tellg());
+    ifs.seekg(0);
+    ifs.read(buffer.data(), buffer.size());
+    return buffer;
+}
+
+// Splits the buffer into at most n ranges of whole lines of similar size.
+static inline vector<string_view> split_lines(string_view buffer, size_t n) {
+    vector<string_view> ranges;
 
-        if (!num_copies.empty()) {
-            num_current_cards += num_copies.front();
-            num_copies.pop_front();
+    for (; !buffer.empty(); --n) {
+        size_t len = buffer.size();
+        if (n > 1) {
+            size_t eol = buffer.find('\n', len / n);
+            len = eol == string_view::npos ? len : eol + 1;
         }
+        ranges.push_back(buffer.substr(0, len));
+        buffer.remove_prefix(len);
+    }
+
+    return ranges;
+}
 
-        strip_colon(line);
-        auto winning_numbers = get_and_strip_winning_numbers(line);
-        auto card_numbers = get_card_numbers(line);
-        int wins = 0;
+// Phase one: the wins of every card, computed on line-aligned ranges of the
+// pile in parallel. Cards don't depend on each other's copies.
+static vector<uint16_t> parallel_wins(string_view buffer,
+                                     unsigned num_threads) {
+    auto ranges = split_lines(buffer, num_threads);
+    vector<vector<uint16_t>> partials(ranges.size());
+    vector<thread> workers;
+    vector<uint16_t> wins;
 
-        for (auto num : card_numbers) {
-            if (winning_numbers.contains(num)) {
-                ++wins;
-            }
+    auto count_range = [&](size_t i) {
+        string_view range = ranges[i];
+        CardLayout layout;
+        while (!range.empty()) {
+            string_view line = range.substr(0, range.find('\n'));
+            range.remove_prefix(min(line.size() + 1, range.size()));
+            partials[i].push_back(layout.count_wins(line));
         }
+    };
 
-        auto it = num_copies.begin();
-        for (int i = 0; i < wins; ++i) {
-            if (it != num_copies.end()) {
-                (*it) += num_current_cards;
-                ++it;
-            } else {
-                num_copies.push_back(num_current_cards);
-            }
+    for (size_t i = 1; i < ranges.size(); ++i) {
+        workers.emplace_back(count_range, i);
+    }
+    if (!ranges.empty()) {
+        count_range(0);
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+
+    for (const auto &partial : partials) {
+        wins.insert(wins.end(), partial.begin(), partial.end());
+    }
+    return wins;
+}
+
+unsigned long sum_points(span<const uint16_t> wins) {
+    unsigned long sum = 0;
+    for (auto w : wins) {
+        if (w > 0) {
+            sum += 1UL << (w - 1);
         }
+    }
+    return sum;
+}
 
-        sum += num_current_cards;
+// Phase two: propagates the copies in one pass over a difference array, where
+// a card with w wins adds its instances to the next w cards by marking where
+// the addition starts and ends.
+card_count_t count_cards(span<const uint16_t> wins) {
+    size_t max_wins = wins.empty() ? 0 : *max_element(wins.begin(), wins.end());
+    vector<card_count_t> diff(wins.size() + max_wins + 1);
+    card_count_t copies = 0;
+    card_count_t sum = 0;
+
+    for (size_t i = 0; i < wins.size(); ++i) {
+        copies += diff[i];
+        card_count_t instances = 1 + copies;
+        diff[i + 1] += instances;
+        diff[i + 1 + wins[i]] -= instances;
+        sum += instances;
     }
 
     return sum;
 }
 
 int main(int argc, char **argv) {
-    if (argc != 3) {
-        cerr << "There must be exactly 3 arguments." << endl;
+    if (argc != 3 && argc != 5) {
+        cerr << "Usage: " << argv[0] << " <mode> <input|-> [-j <threads>]"
+             << endl;
         return -1;
     }
 
     int mode = stoi(argv[1]);
     string filename(argv[2]);
+    unsigned num_threads = 1;
+
+    if (argc == 5) {
+        if (string_view(argv[3]) != "-j") {
+            cerr << "Unknown option: " << argv[3] << endl;
+            return -1;
+        }
+        // Zero threads means one per hardware thread.
+        num_threads = stoul(argv[4]);
+        if (num_threads == 0) {
+            num_threads = max(thread::hardware_concurrency(), 1U);
+        }
+    }
 
-    if (mode == 1) {
+    if (num_threads > 1 && (mode == 1 || mode == 2)) {
+        vector<uint16_t> wins = parallel_wins(read_file(filename), num_threads);
+        if (mode == 1) {
+            cout << sum_points(wins) << endl;
+        } else {
+            cout << count_cards(wins) << endl;
+        }
+    } else if (mode == 1) {
         cout << part_one(filename) << endl;
     } else if (mode == 2) {
         cout << part_two(filename) << endl;
+    } else if (mode == 3) {
+        run_session(filename);
     } else {
-        cerr << "Unknown mode (must be either 1 or 2): " << mode << endl;
+        cerr << "Unknown mode (must be 1, 2 or 3): " << mode << endl;
         return -1;
     }
 
@@ -207,10 +207,145 @@ using map_t = map<num_t, pair<num_t, num_t>>; // src -> (dst, len)
 
 constexpr unsigned int num_maps = 7;
 
+// Maps [src, src + len) to [dst, dst + len).
+class Segment {
+public:
+    num_t src, dst, len;
+};
+
+using segments_t = vector<Segment>; // sorted by src
+
+/**
+ * Returns the segments of a map sorted by src, with the gaps between the map
+ * entries filled with identity segments, so that they tile [0, max).
+ */
+static inline segments_t tile_segments(const map_t &map) {
+    segments_t segments;
+    num_t next = 0; // Start of the part not tiled yet
+
+    for (const auto &[src, entry] : map) {
+        const auto &[dst, len] = entry;
+        if (src < next) {
+            throw invalid_argument("Overlapping map entries at src: " +
+                                   to_string(src));
+        }
+        if (src > next) {
+            segments.push_back({next, next, src - next});
+        }
+        if (len > 0) {
+            segments.push_back({src, dst, len});
+        }
+        next = src + len;
+    }
+    if (next < numeric_limits<num_t>::max()) {
+        segments.push_back({next, next, numeric_limits<num_t>::max() - next});
+    }
+
+    return segments;
+}
+
+/**
+ * Composes two tilings into one, mapping src through first and then second:
+ * the image of each segment of first is split where it crosses the segments
+ * of second. Pieces that continue the previous one in both src and dst are
+ * merged, so the result stays as small as the breakpoints allow.
+ */
+static inline segments_t compose_segments(const segments_t &first,
+                                          const segments_t &second) {
+    segments_t composed;
+
+    for (const auto &segment : first) {
+        num_t src = segment.src;
+        num_t mid = segment.dst;
+        num_t len = segment.len;
+
+        // The segment of second containing mid is the last one starting at
+        // or before it.
+        auto it = upper_bound(
+            second.begin(), second.end(), mid,
+            [](num_t value, const Segment &s) { return value < s.src; });
+        --it;
+
+        while (len > 0) {
+            num_t piece = min(len, it->src + it->len - mid);
+            num_t dst = it->dst + (mid - it->src);
+
+            if (!composed.empty() &&
+                composed.back().src + composed.back().len == src &&
+                composed.back().dst + composed.back().len == dst) {
+                composed.back().len += piece;
+            } else {
+                composed.push_back({src, dst, piece});
+            }
+            src += piece;
+            mid += piece;
+            len -= piece;
+            ++it;
+        }
+    }
+
+    return composed;
+}
+
+/**
+ * A map stored as structure-of-arrays tables in Eytzinger (BFS) order: node k
+ * has children 2k and 2k + 1, so the top levels of the search share a few
+ * cache lines and the next levels can be prefetched. The search key is the
+ * end of each segment, and node 0 is an identity segment for numbers past the
+ * last end.
+ */
+class RangeTable {
+public:
+    RangeTable() : ends(1, 0), srcs(1, 0), dsts(1, 0) {}
+
+    explicit RangeTable(const segments_t &segments)
+        : ends(segments.size() + 1, 0), srcs(segments.size() + 1, 0),
+          dsts(segments.size() + 1, 0) {
+        size_t i = 0;
+        place(segments, i, 1);
+    }
+
+    // Finds the first segment that ends past src without branching on the
+    // comparisons; the loop only depends on the size of the table.
+    num_t operator()(num_t src) const {
+        const size_t n = ends.size() - 1;
+        size_t k = 1;
+
+        while (k <= n) {
+            __builtin_prefetch(ends.data() + k * 8);
+            k = 2 * k + (ends[k] <= src);
+        }
+        k >>= __builtin_ffsl(~k);
+
+        return dsts[k] + (src - srcs[k]);
+    }
+
+private:
+    // Places the sorted segments by an in-order walk of the implicit tree.
+    void place(const segments_t &segments, size_t &i, size_t k) {
+        if (k >= ends.size()) {
+            return;
+        }
+        place(segments, i, 2 * k);
+        ends[k] = segments[i].src + segments[i].len;
+        srcs[k] = segments[i].src;
+        dsts[k] = segments[i].dst;
+        ++i;
+        place(segments, i, 2 * k + 1);
+    }
+
+    vector<num_t> ends;
+    vector<num_t> srcs;
+    vector<num_t> dsts;
+};
+
 class Input {
 public:
     seeds_t seeds;
     map_t maps[num_maps];
+    segments_t segments[num_maps];
+    RangeTable tables[num_maps];
+    RangeTable seed_to_location; // All the maps composed
 };
 
 void print_map_entry(map_t::const_iterator it) {
@@ -310,33 +445,23 @@ static inline Input read_input(const string_view filename) {
         }
     }
 
-    return input;
-}
-
-static inline num_t map_look_up(num_t src, const map_t &map) {
-    auto it = map.lower_bound(src);
-
-    // If src is in range, find the dst.
-    if (it != map.end() && src >= it->first &&
-        src < it->first + it->second.second) {
-        return it->second.first + (src - it->first);
+    for (unsigned int i = 0; i < num_maps; ++i) {
+        input.segments[i] = tile_segments(input.maps[i]);
+        input.tables[i] = RangeTable(input.segments[i]);
     }
 
-    // If src is in range of the previous map entry, find the dst.
-    if (it != map.begin()) {
-        --it;
-        if (src >= it->first && src < it->first + it->second.second) {
-            return it->second.first + (src - it->first);
-        }
+    segments_t composed = input.segments[0];
+    for (unsigned int i = 1; i < num_maps; ++i) {
+        composed = compose_segments(composed, input.segments[i]);
     }
+    input.seed_to_location = RangeTable(composed);
 
-    // Otherwise, src is not explicitly mapped. Use the same number as the dst.
-    return src;
+    return input;
 }
 
 static inline num_t
 location_look_up(num_t src, unsigned int map_index, const Input &input) {
-    num_t dst = map_look_up(src, input.maps[map_index]);
+    num_t dst = input.tables[map_index](src);
     if (map_index < num_maps - 1) {
         return location_look_up(dst, map_index + 1, input);
     } else {
@@ -344,7 +469,8 @@ location_look_up(num_t src, unsigned int map_index, const Input &input) {
     }
 }
 
-num_t part_one(const Input &input) {
+// Looks up every seed through the maps one stage at a time.
+num_t part_one_stages(const Input &input) {
     num_t min_location = numeric_limits<num_t>::max();
 
     for (auto seed : input.seeds) {
@@ -357,6 +483,69 @@ num_t part_one(const Input &input) {
     return min_location;
 }
 
+// Looks up every seed with a single search of the composed map.
+num_t part_one(const Input &input) {
+    num_t min_location = numeric_limits<num_t>::max();
+
+    for (auto seed : input.seeds) {
+        min_location = min(min_location, input.seed_to_location(seed));
+    }
+
+    return min_location;
+}
+
+/**
+ * Maps sorted values through a stage by sweeping them together with its
+ * sorted segments, then restores the order. Values mapped by the same segment
+ * stay in order, so only the runs where an offset breaks the order are merged.
+ */
+static inline void merge_stage(vector<num_t> &values,
+                               const segments_t &segments) {
+    vector<size_t> runs{0}; // Starts of the ordered runs
+    auto it = segments.begin();
+
+    for (size_t i = 0; i < values.size(); ++i) {
+        while (next(it) != segments.end() && it->src + it->len <= values[i]) {
+            ++it;
+        }
+        values[i] = it->dst + (values[i] - it->src);
+        if (i > 0 && values[i] < values[i - 1]) {
+            runs.push_back(i);
+        }
+    }
+    runs.push_back(values.size());
+
+    // Merges adjacent runs pairwise until a single run is left.
+    while (runs.size() > 2) {
+        size_t num_runs = runs.size() - 1;
+        vector<size_t> merged;
+
+        for (size_t r = 0; r + 1 < num_runs; r += 2) {
+            inplace_merge(values.begin() + runs[r],
+                          values.begin() + runs[r + 1],
+                          values.begin() + runs[r + 2]);
+            merged.push_back(runs[r]);
+        }
+        if (num_runs % 2 == 1) {
+            merged.push_back(runs[num_runs - 1]);
+        }
+        merged.push_back(values.size());
+        runs = move(merged);
+    }
+}
+
+// Sorts the seeds once and maps the whole batch through each stage in turn.
+num_t part_one_merge(const Input &input) {
+    vector<num_t> values = input.seeds;
+
+    sort(values.begin(), values.end());
+    for (const auto &segments : input.segments) {
+        merge_stage(values, segments);
+    }
+
+    return values.empty() ? numeric_limits<num_t>::max() : values.front();
+}
+
 class Range {
 public:
     num_t first, second; // inclusive: [first, second]
@@ -485,21 +674,37 @@ unsigned long part_two(const Input &input) {
 }
 
 int main(int argc, char **argv) {
-    if (argc != 3) {
-        cerr << "There must be exactly 3 arguments." << endl;
+    if (argc != 3 && argc != 5) {
+        cerr << "Usage: " << argv[0] << " <mode> <input> [-e <engine>]"
+             << endl;
         return -1;
     }
 
     int mode = stoi(argv[1]);
     string filename(argv[2]);
+    string_view engine = "composed";
+
+    if (argc == 5) {
+        if (string_view(argv[3]) != "-e") {
+            cerr << "Unknown option: " << argv[3] << endl;
+            return -1;
+        }
+        engine = argv[4];
+    }
+
     Input input = read_input(filename);
 
-    if (mode == 1) {
+    if (engine == "composed" && mode == 1) {
         cout << part_one(input) << endl;
+    } else if (engine == "stages" && mode == 1) {
+        cout << part_one_stages(input) << endl;
+    } else if (engine == "merge" && mode == 1) {
+        cout << part_one_merge(input) << endl;
     } else if (mode == 2) {
         cout << part_two(input) << endl;
     } else {
-        cerr << "Unknown mode (must be either 1 or 2): " << mode << endl;
+        cerr << "Unknown mode (must be either 1 or 2) for engine " << engine
+             << ": " << mode << endl;
         return -1;
     }
 